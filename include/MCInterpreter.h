@@ -0,0 +1,107 @@
+#ifndef MC_INTERPRETER_H
+#define MC_INTERPRETER_H
+
+#include "OptimizedDumper.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+
+// Runs the MC of a whole program as any stage of optimizeMC leaves it,
+// without going through assembly. Locals, parameters and temporaries live
+// in a frame per call, globals once, and names starting with $ in a single
+// register file the way the machine has it, so the code after register
+// assignment runs with its argument registers, $v0 and the saves around
+// calls. A callee there leaves alone the registers its callers were told
+// it would, so a stage before the callee's final code runs against the
+// summary that code gave. Printing and reading set $a0 and $v0 as the
+// syscalls do, and a char variable keeps the low byte of what is stored.
+class MCInterpreter {
+public:
+    // a block as the stage has it and the kinds of its codes
+    struct Block {
+        std::string function, label;
+        size_t index;
+        std::vector<OP> ops;
+    };
+
+    explicit MCInterpreter(const Program &prog);
+
+    // false with the reason in getError() when the code of a function is
+    // missing or names something it can't have; clobbers are the registers
+    // each function may change, the rest surviving calls to it
+    bool load(const std::map<const Function *, OptimizedDumper::codeInfo> &code,
+        const std::map<const Function *, std::set<std::string>> &clobbers);
+    // from main until it returns or limit blocks ran, 0 for no limit; false
+    // with the reason in getError() on a fault
+    bool run(std::istream &in, std::ostream &out, uint64_t limit = 0);
+
+    const std::vector<Block> &getBlocks() const {
+        return blocks;
+    }
+    // how often each of getBlocks() ran
+    const std::vector<uint64_t> &getCounts() const {
+        return counts;
+    }
+    // codes run by class (move, alu, array, branch, call, io) and the total,
+    // a block faulting half way counting as a whole
+    std::map<std::string, uint64_t> byClass() const;
+    // one "stage function block label runs" line per block
+    void blockCounts(std::ostream &s, const std::string &stage) const;
+    const std::string &getError() const {
+        return error;
+    }
+
+    // the codes each stage ran, what that changed from the stage before and
+    // how its output compares to the first stage's
+    static void report(std::ostream &s, const std::vector<std::string> &stages,
+        const std::vector<const MCInterpreter *> &runs, const std::vector<std::string> &outputs);
+protected:
+    // where an operand is: the frame of the running call, the globals, the
+    // registers or the constants
+    enum Base {
+        bFrame, bGlobal, bReg, bConst
+    };
+    struct Operand {
+        uint8_t base;
+        bool narrow;
+        uint32_t index;
+    };
+    // one pre-decoded code: d, a and b as the MC has them, an array in d
+    // with its length in target, the instruction of a branch, the function
+    // of a call or argument and the string printed in target otherwise
+    struct Inst {
+        uint8_t kind;
+        Operand d, a, b;
+        uint32_t target;
+        size_t line;
+    };
+    struct Func {
+        std::string name;
+        size_t entry, frameSize, params;
+        std::vector<bool> narrowParams;
+        // registers a call to it keeps
+        std::vector<uint32_t> kept;
+    };
+
+    const Program &prog;
+    std::vector<Inst> insts;
+    std::vector<Func> funcs;
+    std::vector<Block> blocks;
+    std::vector<uint64_t> counts;
+    std::vector<int32_t> constants;
+    std::vector<std::string> strings;
+    std::vector<uint32_t> argRegs;
+    uint32_t globalSize, regCount, v0, a0;
+    size_t mainFunc, maxParams;
+    bool regForm;
+    std::string error;
+
+    bool fault(const Inst *ip, const std::string &why);
+};
+
+#endif // MC_INTERPRETER_H
@@ -0,0 +1,92 @@
+#ifndef MIPS_H
+#define MIPS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+// One line of emitted assembly: an instruction, a label, a comment or a
+// blank separator. Operands are kept as written ("$t0", "12($sp)", "L").
+struct MIPS {
+    std::string op;
+    std::vector<std::string> args;
+    std::string label;
+    std::string comment;
+    // source line the instruction was compiled from, 0 when unknown
+    size_t line = 0;
+
+    static MIPS parse(const std::string &line);
+    std::string str() const;
+
+    bool isInst() const {
+        return !op.empty();
+    }
+    bool isLabel() const {
+        return !label.empty();
+    }
+
+    bool isBranch() const;
+    bool isJump() const;
+    bool isCall() const;
+    bool isLoad() const;
+    bool isStore() const;
+    std::string target() const;
+
+    // registers written and read, "$hi"/"$lo" included
+    std::vector<std::string> defs() const;
+    std::vector<std::string> uses() const;
+    // base register of a memory operand, empty for absolute labels
+    std::string base() const;
+};
+
+// registers arguments travel in between the functions of one program:
+// $a0-$a3 as in o32, then $t5-$t8, which register assignment keeps out of
+// its pool for that; further arguments go below the caller's $sp
+extern const std::vector<std::string> mipsArgRegs;
+
+// machine instructions a line assembles to, pseudo-instructions expanded
+// the way MARS does
+size_t mipsLength(const MIPS &m);
+
+// cycles one instruction is charged, pseudo-instructions by their expansion;
+// the one cost table code generation decisions are made against
+size_t mipsCost(const MIPS &m);
+
+// sequences for dst = a * c, a / d and a % d with constant c and d in place
+// of mul, div and rem, $t9 as scratch and dst allowed to equal a;
+// multiplication picks shifts and adds when mipsCost rates them below li + mul
+std::vector<std::string> mipsMulByConst(const std::string &dst, const std::string &a, int32_t c);
+// d != 0, truncating toward zero
+std::vector<std::string> mipsDivByConst(const std::string &dst, const std::string &a, int32_t d);
+// d != 0, with the sign of a
+std::vector<std::string> mipsRemByConst(const std::string &dst, const std::string &a, int32_t d);
+
+// cycles from issuing an instruction until a dependent one can issue
+// without stalling; mnemonics missing from the table take 1
+struct MIPSLatency {
+    std::map<std::string, size_t> cycles;
+
+    // the "r3000" model
+    MIPSLatency();
+
+    size_t of(const MIPS &m) const;
+    // comma separated model names ("r3000", "r4000", "unit") and
+    // "op=cycles" overrides, applied left to right
+    bool configure(const std::string &spec);
+};
+
+// MIPS peephole over one function, hit counts are added to hits[rule]
+void mipsPeephole(std::vector<MIPS> &code, std::map<std::string, size_t> &hits);
+
+// list scheduling inside each straight-line run of one function, keeping
+// register and memory dependences; counts are added to stats["sched.*"]
+void mipsSchedule(std::vector<MIPS> &code, const MIPSLatency &lat,
+        std::map<std::string, size_t> &stats);
+
+// fills the delay slot of every branch, jump and call for .set noreorder,
+// from before the branch, its target or its fall-through, else with a nop;
+// counts are added to stats["delay.*"]
+void mipsFillDelaySlots(std::vector<MIPS> &code, std::map<std::string, size_t> &stats);
+
+#endif // MIPS_H
@@ -0,0 +1,132 @@
+#ifndef MIPS_SIMULATOR_H
+#define MIPS_SIMULATOR_H
+
+#include "MIPS.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+
+// What a run is charged in cycles: an in-order pipeline issuing one
+// machine instruction a cycle and waiting for results by the latency
+// table, a blocking data cache with LRU replacement that loads and stores
+// allocate lines in, branches predicted taken backwards and not taken
+// forwards, and a nop in the delay slot of every branch and jump unless
+// the code was built for .set noreorder.
+struct MIPSCostModel {
+    MIPSLatency latency;
+    size_t cacheSize, lineSize, ways, missPenalty;
+    size_t mispredictPenalty, slotPenalty;
+
+    // 4 KiB direct mapped with 16 byte lines, 10 cycles a miss, 2 a
+    // mispredicted branch and 1 a delay slot
+    MIPSCostModel();
+
+    // comma separated cache=, line=, ways=, miss=, mispredict= and slot=
+    // settings, anything else goes to the latency table
+    bool configure(const std::string &spec);
+};
+
+// Runs the assembly the dumpers emit the way MARS does: .data from
+// 0x10010000, .text from 0x00400000 with one word per line, $sp at
+// 0x7fffeffc, execution from main, delayed branches after .set noreorder
+// and the syscalls printing and reading ints, chars and strings and
+// exiting. The "# line N" comments of -g tie what runs to source lines.
+class MIPSSimulator {
+public:
+    MIPSCostModel cost;
+
+    // what running one line came to
+    struct LineCounts {
+        uint64_t runs, taken, cycles, accesses, misses;
+        // cycles spent waiting for an operand, on the data cache and on
+        // branches, included in cycles
+        uint64_t dataStall, cacheStall, branchStall;
+    };
+
+    MIPSSimulator();
+
+    // false with the reason in getError() when a line can't be assembled
+    bool load(std::istream &s);
+    // until exit, the end of .text or limit instructions, 0 for no limit;
+    // false with the reason in getError() on a fault
+    bool run(std::istream &in, std::ostream &out, uint64_t limit = 0);
+
+    // instructions run by class (alu, muldiv, load, store, branch, jump,
+    // call, syscall, nop), branches taken, the total and the machine
+    // instructions they assemble to
+    std::map<std::string, uint64_t> byClass() const;
+    // the counts of the lines of each function, by its entry label
+    std::map<std::string, LineCounts> byFunction() const;
+    // the counts of the lines compiled from each source line of a function
+    std::map<std::pair<std::string, size_t>, LineCounts> bySource() const;
+    void report(std::ostream &s) const;
+    // the cycles of every source line under every chain of calls it ran
+    // in, one "main;f;g;g:12 cycles" line each, for flame graphs
+    void collapsedStacks(std::ostream &s) const;
+
+    const std::vector<MIPS> &getCode() const {
+        return code;
+    }
+    const std::vector<LineCounts> &getCounts() const {
+        return counts;
+    }
+    // line of the assembly each line of getCode() came from
+    const std::vector<size_t> &getLines() const {
+        return lines;
+    }
+    // entry label of the function each line of getCode() belongs to: main
+    // and everything called, "" before the first
+    const std::vector<std::string> &getFunctions() const {
+        return functions;
+    }
+    // source line of each line of getCode(), 0 when unknown
+    const std::vector<size_t> &getSources() const {
+        return sources;
+    }
+    const std::string &getError() const {
+        return error;
+    }
+protected:
+    // one pre-decoded line: an immediate takes the place of t when useImm,
+    // memory operands are s + imm with s 0 for absolute addresses; $hi and
+    // $lo are registers 32 and 33 in uses and defs
+    struct Inst {
+        int kind;
+        uint8_t d, s, t;
+        bool useImm;
+        int32_t imm;
+        size_t target;
+        uint32_t length;
+        std::vector<uint8_t> uses, defs;
+    };
+    // a node of the call tree: the function, its caller's node and the
+    // cycles it spent by source line
+    struct Frame {
+        std::string function;
+        size_t parent;
+        std::map<std::string, size_t> callees;
+        std::map<size_t, uint64_t> cycles;
+    };
+
+    std::vector<MIPS> code;
+    std::vector<size_t> lines;
+    std::vector<std::string> functions;
+    std::vector<size_t> sources;
+    std::vector<Inst> insts;
+    std::vector<Frame> frames;
+    std::vector<LineCounts> counts;
+    std::map<std::string, uint32_t> symbols;
+    std::vector<uint8_t> data, stack;
+    bool delayed;
+    size_t entry;
+    std::string error;
+
+    bool fault(const std::string &why);
+    uint8_t *at(uint32_t addr, uint32_t size);
+};
+
+#endif // MIPS_SIMULATOR_H
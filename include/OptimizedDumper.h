@@ -4,13 +4,14 @@
 #include "Dumper.h"
 #include "ASTNode.h"
 #include "Semantics.h"
+#include "MIPS.h"
 
 #include <iostream>
 #include <sstream>
 
 enum OP {
     oli, oneg, omov, omovv0, oarg,
-    oadd, osub, omul, odiv,
+    oadd, osub, omul, odiv, omod,
     oloadarr, ostorearr,
     ojmp, obeq, obne, oblt, oble, obgt, obge,
     obeqz, obnez,
@@ -50,6 +51,8 @@ struct MC {
     std::string dst;
     std::string a;
     std::string b;
+    // source line of the statement it came from, 0 when unknown
+    size_t line = 0;
     void toQuad(std::ostream &stream, const std::string &indent, const Function &func) const;
 };
 
@@ -66,19 +69,48 @@ struct OptimizedDumper : public Dumper {
     std::map<const Function *, std::map<std::string, std::string>> protectRegs;
     std::map<const Function *, bool> polluteAReg;
     std::map<const Function *, bool> hasCall;
-    std::map<const Function *, bool> hasStInter;
+    // locals and parameters read or written in memory
+    std::map<const Function *, std::set<std::string>> frameVars;
+    // registers a call may change, including everything the callee calls
+    std::map<const Function *, std::set<std::string>> clobbers;
+    std::map<const Function *, std::map<std::string, size_t>> stats;
+    // how often each block ran and took its closing branch, by function and
+    // block index as optLayout sees them
+    std::map<std::string, std::vector<std::pair<size_t, size_t>>> profile;
 
+    std::map<std::string, std::vector<MIPS>> mips;
     std::map<std::string, std::vector<std::string>> text;
 
+    // latency model the scheduler targets
+    MIPSLatency latency;
+    // emit .set noreorder and fill branch delay slots
+    bool delaySlots = false;
+    // copies of the body in a partially unrolled loop, 1 turns unrolling off
+    size_t unrollFactor = 4;
+    // AST nodes unrolling may add to a function
+    size_t unrollBudget = 512;
+    // count block executions and fall-throughs and print them when main ends
+    bool profileGenerate = false;
+    // precede instructions with "# line N" comments naming their source line
+    bool lineInfo = false;
+    // keep the code of every function as each stage of optimizeMC leaves it
+    bool keepStages = false;
+    // stage name and the code of every function after it, in pipeline order
+    std::vector<std::pair<std::string, std::map<const Function *, codeInfo>>> stages;
+
     template<class T>
     void operator()(T &local, const ASTNode &node);
 
     void saveCode(std::ostream &s) {
         s << ss.str() << std::endl;
     }
+
+    // reads what an instrumented program printed after "# profile"
+    bool loadProfile(std::istream &s);
 };
 
-void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &codes, std::vector<std::string> &labels);
+void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &codes, std::vector<std::string> &labels,
+        OptimizedDumper &dumper);
 void dumpOptQuad(const OptimizedDumper &dumper, std::ostream &stream);
 void optDAG(const Function &local, std::vector<MC> &codes,
         std::vector<MC> &entities, std::map<std::string, size_t> &ie,
@@ -91,7 +123,27 @@ void optRestore(const Function &local,
         const std::vector<std::set<std::string>> &cover,
         std::vector<std::set<std::string>> &restore);
 void optimizeMC(Function &local, std::vector<std::vector<MC>> &codes,
+        std::vector<std::string> &labels, OptimizedDumper &dumper);
+std::string mcDef(const MC &c);
+std::vector<std::string> mcUses(const MC &c);
+void optRemoveBlocks(std::vector<std::vector<MC>> &codes, std::vector<std::string> &labels,
+        const std::vector<bool> &keep);
+void optTailRecursion(Function &local, std::vector<std::vector<MC>> &codes,
+        std::vector<std::string> &labels, OptimizedDumper &dumper);
+void optSCCP(const Function &local, std::vector<std::vector<MC>> &codes,
+        std::vector<std::string> &labels, OptimizedDumper &dumper);
+void optGVN(const Function &local, std::vector<std::vector<MC>> &codes,
+        const std::vector<std::string> &labels, OptimizedDumper &dumper);
+void optCopyProp(const Function &local, std::vector<std::vector<MC>> &codes,
+        const std::vector<std::string> &labels, OptimizedDumper &dumper);
+void optCoalesce(const Function &local, std::vector<std::vector<MC>> &entities,
+        const std::vector<std::string> &labels, OptimizedDumper &dumper);
+void optDCE(const Function &local, std::vector<std::vector<MC>> &codes,
         const std::vector<std::string> &labels, OptimizedDumper &dumper);
+void optCleanCFG(const Function &local, std::vector<std::vector<MC>> &codes,
+        std::vector<std::string> &labels, OptimizedDumper &dumper);
+void optLayout(const Function &local, std::vector<std::vector<MC>> &codes,
+        std::vector<std::string> &labels, OptimizedDumper &dumper);
 void optAssignReg(Function &local,
         std::vector<std::vector<MC>> &entities,
         const std::vector<std::string> &labels,
@@ -99,6 +151,7 @@ void optAssignReg(Function &local,
         OptimizedDumper &dumper);
 std::vector<std::vector<size_t>> optCalcNxt(const std::vector<std::vector<MC>> &entities,
         const std::vector<std::string> &labels);
+std::vector<size_t> optCalcIdom(const std::vector<std::vector<size_t>> &nxt);
 void optToMIPS(Function &local, OptimizedDumper &dumper);
 
 #endif // OPTIMIZED_DUMPER_H
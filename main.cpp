@@ -8,9 +8,15 @@
 #include "SimpleDumper.h"
 #include "OptimizedDumper.h"
 #include "SpecialDumper.h"
+#include "MIPSSimulator.h"
+#include "MCInterpreter.h"
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iterator>
+#include <vector>
+#include <cstdlib>
 
 #define CHECK_ERROR \
     if(Logger::getInstance().hasError || Logger::getInstance().hasFatal) { \
@@ -20,7 +26,88 @@
 
 int main(int argc, const char *argv[]) {
     std::string src_path, o0_quad_path, o0_asm_path, o1_quad_path, o1_asm_path, sp_c_path;
-    if(argc <= 1) {
+    std::string latency_spec, profile_path, cost_spec, stacks_path, blocks_path;
+    bool delay_slots = false, profile_generate = false, run = false, line_info = false, interpret = false;
+    long unroll_factor = 4;
+    // options may appear anywhere, the rest is positional
+    std::vector<const char *> args;
+    for(int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(i == 0 || arg.size() < 2 || arg[0] != '-') {
+            args.push_back(argv[i]);
+        } else if(arg.compare(0, 10, "-mlatency=") == 0) {
+            latency_spec = arg.substr(10);
+        } else if(arg == "-fdelay-slots") {
+            delay_slots = true;
+        } else if(arg.compare(0, 16, "-funroll-factor=") == 0) {
+            char *end;
+            unroll_factor = strtol(arg.c_str() + 16, &end, 10);
+            if(arg.size() == 16 || *end || unroll_factor < 1) {
+                std::cerr << "bad unroll factor " << arg.substr(16) << std::endl;
+                return 1;
+            }
+        } else if(arg == "-g") {
+            line_info = true;
+        } else if(arg == "-fprofile-generate") {
+            profile_generate = true;
+        } else if(arg.compare(0, 14, "-fprofile-use=") == 0) {
+            profile_path = arg.substr(14);
+        } else if(arg == "--run") {
+            run = true;
+        } else if(arg.compare(0, 7, "--cost=") == 0) {
+            cost_spec = arg.substr(7);
+        } else if(arg.compare(0, 9, "--stacks=") == 0) {
+            stacks_path = arg.substr(9);
+        } else if(arg == "--interpret") {
+            interpret = true;
+        } else if(arg.compare(0, 9, "--blocks=") == 0) {
+            blocks_path = arg.substr(9);
+        } else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    argc = (int)args.size();
+    argv = args.data();
+    // runs compiled code on stdin and stdout, counts go to stderr
+    if(run) {
+        if(argc != 2) {
+            std::cerr << "Usage: " << argv[0] << " --run [--cost=<spec>] [--stacks=<file>] <asm>" << std::endl;
+            return 1;
+        }
+        std::ifstream fasm(argv[1]);
+        if(fasm.fail()) {
+            std::cerr << "asm " << argv[1] << " does not exist" << std::endl;
+            return -1;
+        }
+        MIPSSimulator sim;
+        if(!sim.cost.configure(latency_spec + "," + cost_spec)) {
+            std::cerr << "bad cost model " << cost_spec << std::endl;
+            return 1;
+        }
+        if(!sim.load(fasm)) {
+            std::cerr << argv[1] << ": " << sim.getError() << std::endl;
+            return -1;
+        }
+        bool ok = sim.run(std::cin, std::cout);
+        sim.report(std::cerr);
+        if(!stacks_path.empty()) {
+            std::ofstream fstacks(stacks_path);
+            sim.collapsedStacks(fstacks);
+        }
+        if(!ok) {
+            std::cerr << argv[1] << ": " << sim.getError() << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+    if(interpret && argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " --interpret [options] [--blocks=<file>] <source>" << std::endl;
+        return 1;
+    }
+    if(interpret) {
+        src_path = argv[1];
+    } else if(argc <= 1) {
         std::cout << "Source path: ";
         std::cin >> src_path;
         std::cout << "Quadruple code output path: ";
@@ -32,7 +119,27 @@ int main(int argc, const char *argv[]) {
         std::cout << "Optimized MIPS ASM output path: ";
         std::cin >> o1_asm_path;
     } else if(argc <= 5) {
-        std::cerr << "Usage: " << argv[0] << " <source> <quad_output> <asm_output> <opt_quad_output> <opt_asm_output>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [options] <source> <quad_output> <asm_output> <opt_quad_output> <opt_asm_output>" << std::endl;
+        std::cerr << "  -mlatency=<spec>  latency model for scheduling: r3000, r4000, unit" << std::endl;
+        std::cerr << "                    and op=cycles overrides, comma separated" << std::endl;
+        std::cerr << "  -fdelay-slots     emit .set noreorder and fill branch delay slots" << std::endl;
+        std::cerr << "  -funroll-factor=<n>  copies per iteration of partially unrolled loops," << std::endl;
+        std::cerr << "                    1 turns loop unrolling off (default 4)" << std::endl;
+        std::cerr << "  -g                mark the optimized code with the source lines it came from" << std::endl;
+        std::cerr << "  -fprofile-generate  count block runs and print them when main ends" << std::endl;
+        std::cerr << "  -fprofile-use=<file>  lay out blocks and weigh spills by the counts" << std::endl;
+        std::cerr << "                    such a run printed" << std::endl;
+        std::cerr << "   or: " << argv[0] << " --run [--cost=<spec>] [--stacks=<file>] <asm>" << std::endl;
+        std::cerr << "  --run             run compiled code on stdin and stdout and count" << std::endl;
+        std::cerr << "                    the instructions by class to stderr" << std::endl;
+        std::cerr << "  --cost=<spec>     cycle model of --run: cache=, line=, ways=, miss=," << std::endl;
+        std::cerr << "                    mispredict=, slot= and -mlatency specs, comma separated" << std::endl;
+        std::cerr << "  --stacks=<file>   write the cycles of --run as collapsed stacks of calls" << std::endl;
+        std::cerr << "                    and source lines, for flame graphs" << std::endl;
+        std::cerr << "   or: " << argv[0] << " --interpret [options] [--blocks=<file>] <source>" << std::endl;
+        std::cerr << "  --interpret       run the MC of every optimizer stage on stdin, print what" << std::endl;
+        std::cerr << "                    the first printed and the codes each ran to stderr" << std::endl;
+        std::cerr << "  --blocks=<file>   write how often each block of each stage ran" << std::endl;
         return 1;
     } else {
         src_path = argv[1];
@@ -56,6 +163,69 @@ int main(int argc, const char *argv[]) {
     Parser parser(tokenizer);
     CHECK_ERROR;
 
+    // runs the code each stage of the optimizer left on the same input,
+    // which they all have to print the same for
+    if(interpret) {
+        Program prog(parser.getRoot());
+        OptimizedDumper dumper;
+        if(!dumper.latency.configure(latency_spec)) {
+            std::cerr << "bad latency model " << latency_spec << std::endl;
+            return 1;
+        }
+        dumper.delaySlots = delay_slots;
+        dumper.unrollFactor = (size_t)unroll_factor;
+        dumper.profileGenerate = profile_generate;
+        dumper.keepStages = true;
+        if(!profile_path.empty()) {
+            std::ifstream fprof(profile_path);
+            if(fprof.fail() || !dumper.loadProfile(fprof)) {
+                std::cerr << "bad profile " << profile_path << std::endl;
+                return 1;
+            }
+        }
+
+        prog.parse(dumper);
+        CHECK_ERROR;
+
+        std::string input((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+        std::vector<std::string> stages, outputs;
+        std::vector<MCInterpreter> runs;
+        // a later stage running far longer than the first is taken to loop
+        uint64_t limit = 0;
+        for(const auto &stage : dumper.stages) {
+            runs.emplace_back(prog);
+            if(!runs.back().load(stage.second, dumper.clobbers)) {
+                std::cerr << stage.first << ": " << runs.back().getError() << std::endl;
+                return -1;
+            }
+            std::istringstream in(input);
+            std::ostringstream out;
+            runs.back().run(in, out, limit);
+            if(runs.size() == 1) {
+                for(uint64_t c : runs.back().getCounts())
+                    limit += 16 * c;
+                limit += 1000000;
+            }
+            stages.push_back(stage.first);
+            outputs.push_back(out.str());
+        }
+        std::vector<const MCInterpreter *> done;
+        bool ok = true;
+        for(const auto &r : runs) {
+            done.push_back(&r);
+            ok = ok && r.getError().empty() && outputs[done.size() - 1] == outputs[0];
+        }
+        if(!outputs.empty())
+            std::cout << outputs[0];
+        MCInterpreter::report(std::cerr, stages, done, outputs);
+        if(!blocks_path.empty()) {
+            std::ofstream fblocks(blocks_path);
+            for(size_t i = 0; i < runs.size(); ++i)
+                runs[i].blockCounts(fblocks, stages[i]);
+        }
+        return ok ? 0 : -1;
+    }
+
     {
         Program prog(parser.getRoot());
         SimpleDumper dumper;
@@ -76,6 +246,21 @@ int main(int argc, const char *argv[]) {
     {
         Program prog(parser.getRoot());
         OptimizedDumper dumper;
+        if(!dumper.latency.configure(latency_spec)) {
+            std::cerr << "bad latency model " << latency_spec << std::endl;
+            return 1;
+        }
+        dumper.delaySlots = delay_slots;
+        dumper.unrollFactor = (size_t)unroll_factor;
+        dumper.profileGenerate = profile_generate;
+        dumper.lineInfo = line_info;
+        if(!profile_path.empty()) {
+            std::ifstream fprof(profile_path);
+            if(fprof.fail() || !dumper.loadProfile(fprof)) {
+                std::cerr << "bad profile " << profile_path << std::endl;
+                return 1;
+            }
+        }
 
         prog.parse(dumper);
         CHECK_ERROR;
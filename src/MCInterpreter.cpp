@@ -0,0 +1,583 @@
+#include "MCInterpreter.h"
+
+#include <set>
+#include <cstdlib>
+#include <iomanip>
+#include <algorithm>
+
+// a frame may not take the stack past this many words
+static const size_t stackLimit = 1 << 24;
+
+enum Kind {
+    kblock, kend, kmov, kneg,
+    kadd, ksub, kmul, kdiv, kmod,
+    kload, kstore,
+    kjmp, kbeq, kbne, kblt, kble, kbgt, kbge,
+    karg, kcall, kret,
+    kpstr, kpint, kpchar, krint, krchar
+};
+
+// the operands of an argument go to the frame the call is about to push
+static const uint8_t bArgs = 4;
+
+static const char *classOf(OP o) {
+    switch(o) {
+    case oli:
+    case omov:
+    case omovv0:
+        return "move";
+    case oneg:
+    case oadd:
+    case osub:
+    case omul:
+    case odiv:
+    case omod:
+        return "alu";
+    case oloadarr:
+    case ostorearr:
+        return "array";
+    case ojmp:
+    case obeq:
+    case obne:
+    case oblt:
+    case oble:
+    case obgt:
+    case obge:
+    case obeqz:
+    case obnez:
+        return "branch";
+    case oarg:
+    case ocall:
+    case oret:
+        return "call";
+    default:
+        break;
+    }
+    return "io";
+}
+
+MCInterpreter::MCInterpreter(const Program &_prog): prog(_prog), globalSize(0), regCount(0),
+    v0(0), a0(0), mainFunc(0), maxParams(0), regForm(false) {}
+
+bool MCInterpreter::fault(const Inst *ip, const std::string &why) {
+    size_t at = (size_t)(ip - insts.data()), f = 0;
+    while(f + 1 < funcs.size() && funcs[f + 1].entry <= at)
+        ++f;
+    error = funcs[f].name + (ip->line ? ", line " + std::to_string(ip->line) : std::string()) + ": " + why;
+    return false;
+}
+
+bool MCInterpreter::load(const std::map<const Function *, OptimizedDumper::codeInfo> &code,
+        const std::map<const Function *, std::set<std::string>> &clobbers) {
+    insts.clear();
+    funcs.clear();
+    blocks.clear();
+    constants.clear();
+    strings.clear();
+    argRegs.clear();
+    error.clear();
+    regForm = false;
+
+    std::map<std::string, uint32_t> regs;
+    auto reg = [&] (const std::string &r) {
+        auto iter = regs.find(r);
+        if(iter != regs.end())
+            return iter->second;
+        return regs[r] = (uint32_t)regs.size();
+    };
+    v0 = reg("$v0");
+    a0 = reg("$a0");
+    for(const auto &r : mipsArgRegs)
+        argRegs.push_back(reg(r));
+
+    // globals are laid out once, scalars taking a word and arrays one per
+    // element
+    std::map<std::string, uint32_t> globals;
+    globalSize = 0;
+    for(const auto &v : prog.varList.variables) {
+        globals[v.identifier] = globalSize;
+        globalSize += v.type == VarIntArray || v.type == VarCharArray ? v.size : 1;
+    }
+    std::map<std::string, uint32_t> strIndex;
+    auto constant = [&] (int32_t v) {
+        constants.push_back(v);
+        return Operand{bConst, false, (uint32_t)(constants.size() - 1)};
+    };
+
+    maxParams = 0;
+    for(size_t f = 0; f < prog.functions.size(); ++f) {
+        const Function &func = prog.functions[f];
+        if(func.node.is("MainFunc"))
+            mainFunc = f;
+        std::vector<bool> narrow;
+        for(size_t i = 0; i < func.paramList.size(); ++i)
+            narrow.push_back(func.paramList[i].type == VarCharType);
+        funcs.push_back(Func{func.identifier, 0, func.paramList.size(), func.paramList.size(), narrow, {}});
+        maxParams = std::max(maxParams, func.paramList.size());
+    }
+
+    for(size_t f = 0; f < prog.functions.size(); ++f) {
+        const Function &func = prog.functions[f];
+        auto iter = code.find(&func);
+        if(iter == code.end()) {
+            error = "no code for " + func.identifier;
+            return false;
+        }
+        const auto &codes = iter->second.codes;
+        const auto &labels = iter->second.labels;
+        Func &out = funcs[f];
+        out.entry = insts.size();
+
+        // every block starts with its counter, the last one is followed
+        // by leaving the function
+        std::map<std::string, uint32_t> starts;
+        size_t at = insts.size();
+        for(size_t i = 0; i < codes.size(); ++i) {
+            if(!labels[i].empty())
+                starts[labels[i]] = (uint32_t)at;
+            at += 1 + codes[i].size();
+        }
+
+        std::map<std::string, uint32_t> frame;
+        auto operand = [&] (const std::string &id, Operand &o) {
+            if(id.empty()) {
+                error = func.identifier + ": missing operand";
+                return false;
+            }
+            if(id[0] == '$') {
+                regForm = true;
+                o = Operand{bReg, false, reg(id)};
+                return true;
+            }
+            if(isdigit(id[0]) || id[0] == '-') {
+                o = constant((int32_t)strtoll(id.c_str(), nullptr, 10));
+                return true;
+            }
+            auto res = func.lookup(id);
+            switch(res.type) {
+            case TParameter:
+                o = Operand{bFrame, res.result.v->type == VarCharType, (uint32_t)func.paramList.lookup.at(id)};
+                return true;
+            case TConstant:
+                o = constant(res.result.c->val);
+                return true;
+            case TGlobalVariable:
+                o = Operand{bGlobal, res.result.v->type == VarCharType || res.result.v->type == VarCharArray,
+                    globals[id]};
+                return true;
+            case TLocalVariable:
+            case TNotFound: {
+                bool isArr = res.type == TLocalVariable
+                    && (res.result.v->type == VarIntArray || res.result.v->type == VarCharArray);
+                auto slot = frame.find(id);
+                if(slot == frame.end()) {
+                    slot = frame.insert({id, (uint32_t)out.frameSize}).first;
+                    out.frameSize += isArr ? res.result.v->size : 1;
+                }
+                o = Operand{bFrame, res.type == TLocalVariable
+                    && (res.result.v->type == VarCharType || res.result.v->type == VarCharArray), slot->second};
+                return true;
+            }
+            default:
+                break;
+            }
+            error = func.identifier + ": " + id + " is not a value";
+            return false;
+        };
+        auto array = [&] (const std::string &id, Operand &o, uint32_t &size) {
+            auto res = func.lookup(id);
+            if((res.type != TLocalVariable && res.type != TGlobalVariable)
+                || (res.result.v->type != VarIntArray && res.result.v->type != VarCharArray)) {
+                error = func.identifier + ": " + id + " is not an array";
+                return false;
+            }
+            size = res.result.v->size;
+            return operand(id, o);
+        };
+        auto callee = [&] (const std::string &id, uint32_t &index) {
+            auto iter = prog.funcList.find(id);
+            if(iter == prog.funcList.end()) {
+                error = func.identifier + ": " + id + " is not a function";
+                return false;
+            }
+            index = (uint32_t)iter->second;
+            return true;
+        };
+
+        for(size_t i = 0; i < codes.size(); ++i) {
+            blocks.push_back(Block{func.identifier, labels[i], i, {}});
+            insts.push_back(Inst{kblock, {}, {}, {}, (uint32_t)(blocks.size() - 1), 0});
+            for(const auto &c : codes[i]) {
+                blocks.back().ops.push_back(c.o);
+                Inst inst {kmov, {}, {}, {}, 0, c.line};
+                bool ok = true;
+                switch(c.o) {
+                case oli:
+                case omov:
+                    ok = operand(c.dst, inst.d) && operand(c.a, inst.a);
+                    break;
+                case omovv0:
+                    inst.a = Operand{bReg, false, v0};
+                    ok = operand(c.dst, inst.d);
+                    break;
+                case oneg:
+                    inst.kind = kneg;
+                    ok = operand(c.dst, inst.d) && operand(c.a, inst.a);
+                    break;
+                case oadd:
+                case osub:
+                case omul:
+                case odiv:
+                case omod:
+                    inst.kind = (uint8_t)(kadd + (c.o - oadd));
+                    ok = operand(c.dst, inst.d) && operand(c.a, inst.a) && operand(c.b, inst.b);
+                    break;
+                case oloadarr:
+                case ostorearr:
+                    inst.kind = c.o == oloadarr ? kload : kstore;
+                    ok = array(c.lab, inst.d, inst.target) && operand(c.a, inst.a) && operand(c.b, inst.b);
+                    break;
+                case ojmp:
+                case obeq:
+                case obne:
+                case oblt:
+                case oble:
+                case obgt:
+                case obge:
+                case obeqz:
+                case obnez: {
+                    auto target = starts.find(c.lab);
+                    if(target == starts.end()) {
+                        error = func.identifier + ": no block " + c.lab;
+                        return false;
+                    }
+                    inst.target = target->second;
+                    if(c.o == ojmp) {
+                        inst.kind = kjmp;
+                    } else if(c.o == obeqz || c.o == obnez) {
+                        inst.kind = c.o == obeqz ? kbeq : kbne;
+                        inst.b = constant(0);
+                        ok = operand(c.a, inst.a);
+                    } else {
+                        inst.kind = (uint8_t)(kbeq + (c.o - obeq));
+                        ok = operand(c.a, inst.a) && operand(c.b, inst.b);
+                    }
+                    break;
+                }
+                case oarg: {
+                    inst.kind = karg;
+                    uint32_t index = (uint32_t)strtoul(c.dst.c_str(), nullptr, 10);
+                    ok = callee(c.lab, inst.target) && operand(c.a, inst.a);
+                    if(ok && index >= funcs[inst.target].params) {
+                        error = func.identifier + ": " + c.lab + " has no argument " + c.dst;
+                        return false;
+                    }
+                    if(ok)
+                        inst.d = Operand{bArgs, funcs[inst.target].narrowParams[index], index};
+                    break;
+                }
+                case ocall:
+                    inst.kind = kcall;
+                    ok = callee(c.lab, inst.target);
+                    break;
+                case oret:
+                    inst.kind = c.dst.empty() ? kend : kret;
+                    ok = c.dst.empty() || operand(c.dst, inst.a);
+                    break;
+                case opstr: {
+                    inst.kind = kpstr;
+                    auto str = prog.strList.strings.find(c.lab);
+                    if(str == prog.strList.strings.end()) {
+                        error = func.identifier + ": no string " + c.lab;
+                        return false;
+                    }
+                    auto index = strIndex.find(c.lab);
+                    if(index == strIndex.end()) {
+                        index = strIndex.insert({c.lab, (uint32_t)strings.size()}).first;
+                        strings.push_back(str->second->getLiteral());
+                    }
+                    inst.target = index->second;
+                    break;
+                }
+                case opint:
+                case opchar:
+                    inst.kind = c.o == opint ? kpint : kpchar;
+                    ok = operand(c.dst, inst.a);
+                    break;
+                case orint:
+                case orchar:
+                    inst.kind = c.o == orint ? krint : krchar;
+                    break;
+                default:
+                    error = func.identifier + ": unknown code";
+                    return false;
+                }
+                if(!ok)
+                    return false;
+                insts.push_back(inst);
+            }
+        }
+        insts.push_back(Inst{kend, {}, {}, {}, 0, 0});
+    }
+    regCount = (uint32_t)regs.size();
+
+    // a function without a summary may change anything
+    for(size_t f = 0; f < prog.functions.size(); ++f) {
+        auto iter = clobbers.find(&prog.functions[f]);
+        if(iter == clobbers.end())
+            continue;
+        for(const auto &r : regs)
+        if(iter->second.find(r.first) == iter->second.end())
+            funcs[f].kept.push_back(r.second);
+    }
+    return true;
+}
+
+bool MCInterpreter::run(std::istream &in, std::ostream &out, uint64_t limit) {
+    counts.assign(blocks.size(), 0);
+    if(funcs.empty())
+        return true;
+
+    std::vector<int32_t> globals(globalSize, 0), regs(regCount, 0), stack, saved;
+    // where a call came from: the code after it, the caller's frame and
+    // function and where the registers the callee keeps were saved
+    struct Return {
+        const Inst *ip;
+        size_t fp, func, saved;
+    };
+    std::vector<Return> calls;
+    size_t func = mainFunc, fp = 0, top = funcs[func].frameSize;
+    stack.assign(std::max<size_t>(1024, top + maxParams), 0);
+
+    int32_t *base[5] = {stack.data(), globals.data(), regs.data(), constants.data(), stack.data() + top};
+    uint64_t *cnt = counts.data(), ran = 0;
+    const Inst *code = insts.data(), *ip = code + funcs[func].entry;
+    auto set = [&] (const Operand &o, int32_t v) {
+        base[o.base][o.index] = o.narrow ? (int32_t)(int8_t)v : v;
+    };
+    #define V(o) base[(o).base][(o).index]
+    auto wrap = [] (uint32_t v) {
+        return (int32_t)v;
+    };
+
+    // every handler goes on to the next one itself, through a table of
+    // label addresses where the compiler has them and the switch otherwise
+#ifdef __GNUC__
+    static const void *const handlers[] = {
+        &&h_kblock, &&h_kend, &&h_kmov, &&h_kneg,
+        &&h_kadd, &&h_ksub, &&h_kmul, &&h_kdiv, &&h_kmod,
+        &&h_kload, &&h_kstore,
+        &&h_kjmp, &&h_kbeq, &&h_kbne, &&h_kblt, &&h_kble, &&h_kbgt, &&h_kbge,
+        &&h_karg, &&h_kcall, &&h_kret,
+        &&h_kpstr, &&h_kpint, &&h_kpchar, &&h_krint, &&h_krchar
+    };
+    #define CASE(k) case k: h_##k:
+    #define DISPATCH goto *handlers[ip->kind]
+#else
+    #define CASE(k) case k:
+    #define DISPATCH continue
+#endif
+    #define NEXT ++ip; DISPATCH
+    #define GOTO(t) { ip = code + (t); DISPATCH; }
+    #define BRANCH(cond) if(cond) GOTO(ip->target); NEXT
+
+    for(;;)
+    switch(ip->kind) {
+    CASE(kblock)
+        if(++ran == limit)
+            return fault(ip, "stopped after " + std::to_string(limit) + " blocks");
+        ++cnt[ip->target];
+        NEXT;
+    CASE(kmov)
+        set(ip->d, V(ip->a));
+        NEXT;
+    CASE(kneg)
+        set(ip->d, wrap(0u - (uint32_t)V(ip->a)));
+        NEXT;
+    CASE(kadd)
+        set(ip->d, wrap((uint32_t)V(ip->a) + (uint32_t)V(ip->b)));
+        NEXT;
+    CASE(ksub)
+        set(ip->d, wrap((uint32_t)V(ip->a) - (uint32_t)V(ip->b)));
+        NEXT;
+    CASE(kmul)
+        set(ip->d, wrap((uint32_t)V(ip->a) * (uint32_t)V(ip->b)));
+        NEXT;
+    CASE(kdiv)
+    CASE(kmod) {
+        int32_t x = V(ip->a), y = V(ip->b);
+        if(!y)
+            return fault(ip, "division by zero");
+        // the one quotient that doesn't fit wraps around as on the machine
+        if(y == -1)
+            set(ip->d, ip->kind == kdiv ? wrap(0u - (uint32_t)x) : 0);
+        else
+            set(ip->d, ip->kind == kdiv ? x / y : x % y);
+        NEXT;
+    }
+    CASE(kload) {
+        int32_t i = V(ip->a);
+        if((uint32_t)i >= ip->target)
+            return fault(ip, "index " + std::to_string(i) + " out of bounds");
+        set(ip->b, base[ip->d.base][ip->d.index + (uint32_t)i]);
+        NEXT;
+    }
+    CASE(kstore) {
+        int32_t i = V(ip->a), v = V(ip->b);
+        if((uint32_t)i >= ip->target)
+            return fault(ip, "index " + std::to_string(i) + " out of bounds");
+        base[ip->d.base][ip->d.index + (uint32_t)i] = ip->d.narrow ? (int32_t)(int8_t)v : v;
+        NEXT;
+    }
+    CASE(kjmp)
+        GOTO(ip->target);
+    CASE(kbeq)
+        BRANCH(V(ip->a) == V(ip->b));
+    CASE(kbne)
+        BRANCH(V(ip->a) != V(ip->b));
+    CASE(kblt)
+        BRANCH(V(ip->a) < V(ip->b));
+    CASE(kble)
+        BRANCH(V(ip->a) <= V(ip->b));
+    CASE(kbgt)
+        BRANCH(V(ip->a) > V(ip->b));
+    CASE(kbge)
+        BRANCH(V(ip->a) >= V(ip->b));
+    CASE(karg)
+        set(ip->d, V(ip->a));
+        NEXT;
+    CASE(kcall) {
+        const Func &f = funcs[ip->target];
+        size_t need = top + f.frameSize + maxParams;
+        if(need > stack.size()) {
+            if(need > stackLimit)
+                return fault(ip, "stack overflow calling " + f.name);
+            stack.resize(std::min(stackLimit, 2 * need), 0);
+        }
+        int32_t *p = stack.data() + top;
+        // the arguments in registers land in the parameters, which the
+        // code after register assignment reads from there or re-reads
+        if(regForm)
+        for(size_t i = 0; i < f.params && i < argRegs.size(); ++i)
+            p[i] = regs[argRegs[i]];
+        std::fill(p + f.params, p + f.frameSize, 0);
+        calls.push_back(Return{ip + 1, fp, func, saved.size()});
+        if(regForm)
+        for(uint32_t r : f.kept)
+            saved.push_back(regs[r]);
+        fp = top;
+        func = ip->target;
+        top = fp + f.frameSize;
+        base[bFrame] = p;
+        base[bArgs] = stack.data() + top;
+        GOTO(f.entry);
+    }
+    CASE(kret)
+        regs[v0] = V(ip->a);
+        goto leave;
+    CASE(kend)
+    leave:
+        // main returning ends the run
+        if(calls.empty())
+            return true;
+        if(regForm) {
+            const auto &kept = funcs[func].kept;
+            for(size_t i = 0; i < kept.size(); ++i)
+                regs[kept[i]] = saved[calls.back().saved + i];
+            saved.resize(calls.back().saved);
+        }
+        ip = calls.back().ip;
+        fp = calls.back().fp;
+        func = calls.back().func;
+        calls.pop_back();
+        top = fp + funcs[func].frameSize;
+        base[bFrame] = stack.data() + fp;
+        base[bArgs] = stack.data() + top;
+        DISPATCH;
+    CASE(kpstr)
+        out << strings[ip->target];
+        regs[a0] = 0;
+        regs[v0] = 4;
+        NEXT;
+    CASE(kpint)
+        regs[a0] = V(ip->a);
+        regs[v0] = 1;
+        out << regs[a0];
+        NEXT;
+    CASE(kpchar)
+        regs[a0] = V(ip->a);
+        regs[v0] = 11;
+        out.put((char)regs[a0]);
+        NEXT;
+    CASE(krint) {
+        long long v;
+        if(!(in >> v))
+            return fault(ip, "no integer to read");
+        regs[v0] = (int32_t)(uint32_t)(unsigned long long)v;
+        NEXT;
+    }
+    CASE(krchar) {
+        char c = 0;
+        if(!(in.get(c)))
+            return fault(ip, "no character to read");
+        regs[v0] = (unsigned char)c;
+        NEXT;
+    }
+    }
+    #undef V
+    #undef CASE
+    #undef DISPATCH
+    #undef NEXT
+    #undef GOTO
+    #undef BRANCH
+}
+
+std::map<std::string, uint64_t> MCInterpreter::byClass() const {
+    std::map<std::string, uint64_t> c;
+    for(const char *cls : {"move", "alu", "array", "branch", "call", "io"})
+        c[cls] = 0;
+    for(size_t i = 0; i < blocks.size(); ++i)
+    for(OP o : blocks[i].ops)
+        c[classOf(o)] += counts[i];
+    uint64_t total = 0;
+    for(const auto &item : c)
+        total += item.second;
+    c["total"] = total;
+    return c;
+}
+
+void MCInterpreter::blockCounts(std::ostream &s, const std::string &stage) const {
+    for(size_t i = 0; i < blocks.size(); ++i)
+        s << stage << " " << blocks[i].function << " " << blocks[i].index << " "
+            << (blocks[i].label.empty() ? "-" : blocks[i].label) << " " << counts[i] << std::endl;
+}
+
+void MCInterpreter::report(std::ostream &s, const std::vector<std::string> &stages,
+        const std::vector<const MCInterpreter *> &runs, const std::vector<std::string> &outputs) {
+    const char *classes[] {"move", "alu", "array", "branch", "call", "io"};
+    s << "# MC run by stage: codes, change from the stage before, by class" << std::endl;
+    s << std::left << std::setw(10) << "stage" << std::right << std::setw(12) << "total" << std::setw(10) << "delta";
+    for(const char *cls : classes)
+        s << std::setw(10) << cls;
+    s << std::setw(8) << "blocks" << std::endl;
+    std::map<std::string, uint64_t> previous;
+    for(size_t i = 0; i < runs.size(); ++i) {
+        auto c = runs[i]->byClass();
+        s << std::left << std::setw(10) << stages[i] << std::right << std::setw(12) << c["total"];
+        if(i) {
+            int64_t d = (int64_t)c["total"] - (int64_t)previous["total"];
+            s << std::setw(10) << (d > 0 ? "+" + std::to_string(d) : std::to_string(d));
+        } else {
+            s << std::setw(10) << "-";
+        }
+        for(const char *cls : classes)
+            s << std::setw(10) << c[cls];
+        s << std::setw(8) << runs[i]->getBlocks().size();
+        if(!runs[i]->getError().empty())
+            s << "  " << runs[i]->getError();
+        else if(outputs[i] != outputs[0])
+            s << "  output differs from " << stages[0];
+        s << std::endl;
+        previous.swap(c);
+    }
+}
@@ -0,0 +1,930 @@
+#include "MIPS.h"
+
+#include <set>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <algorithm>
+
+static std::string trim(const std::string &s) {
+    size_t l = s.find_first_not_of(" \t"), r = s.find_last_not_of(" \t");
+    if(l == std::string::npos)
+        return "";
+    return s.substr(l, r - l + 1);
+}
+
+static bool isReg(const std::string &s) {
+    return !s.empty() && s[0] == '$';
+}
+
+static const std::set<std::string> dstFirstOps {
+    "li", "la", "lui", "move", "neg", "negu", "not",
+    "addu", "addiu", "add", "addi", "subu", "sub", "mul",
+    "sll", "sllv", "sra", "srav", "srl", "srlv",
+    "slt", "slti", "sltu", "sltiu",
+    "and", "andi", "or", "ori", "xor", "xori", "nor",
+    "lw", "lb", "lbu", "lh", "lhu",
+    "mflo", "mfhi", "rem"
+};
+
+static const std::set<std::string> loadOps {
+    "lw", "lb", "lbu", "lh", "lhu"
+}, storeOps {
+    "sw", "sb", "sh"
+};
+
+static const std::map<std::string, std::string> invertBranch {
+    {"beq", "bne"}, {"bne", "beq"},
+    {"blt", "bge"}, {"bge", "blt"},
+    {"ble", "bgt"}, {"bgt", "ble"},
+    {"beqz", "bnez"}, {"bnez", "beqz"},
+    {"bltz", "bgez"}, {"bgez", "bltz"},
+    {"blez", "bgtz"}, {"bgtz", "blez"}
+};
+
+const std::vector<std::string> mipsArgRegs {
+    "$a0", "$a1", "$a2", "$a3", "$t5", "$t6", "$t7", "$t8"
+};
+
+// tuned for the simulator the output runs on, anything missing costs 1
+static const std::map<std::string, size_t> costs {
+    {"mul", 4}, {"mult", 4}, {"multu", 4},
+    {"div", 35}, {"divu", 35}, {"rem", 35},
+    {"lw", 2}, {"lb", 2}, {"lbu", 2}, {"lh", 2}, {"lhu", 2}
+};
+
+// result latencies of the models configure() knows
+static const std::map<std::string, std::map<std::string, size_t>> latencyModels {
+    {"r3000", {
+        {"lw", 2}, {"lb", 2}, {"lbu", 2}, {"lh", 2}, {"lhu", 2},
+        {"mul", 12}, {"mult", 12}, {"multu", 12},
+        {"div", 35}, {"divu", 35}, {"rem", 35}
+    }},
+    {"r4000", {
+        {"lw", 3}, {"lb", 3}, {"lbu", 3}, {"lh", 3}, {"lhu", 3},
+        {"mul", 10}, {"mult", 10}, {"multu", 10},
+        {"div", 69}, {"divu", 69}, {"rem", 69}
+    }},
+    {"unit", {}}
+};
+
+MIPS MIPS::parse(const std::string &line) {
+    MIPS m;
+    std::string s = trim(line);
+    if(s.empty())
+        return m;
+    if(s[0] == '#') {
+        m.comment = s;
+        return m;
+    }
+    if(s.back() == ':') {
+        m.label = s.substr(0, s.size() - 1);
+        return m;
+    }
+    size_t sp = s.find_first_of(" \t");
+    m.op = s.substr(0, sp);
+    if(sp == std::string::npos)
+        return m;
+    std::string rest = s.substr(sp + 1);
+    size_t l = 0;
+    while(l <= rest.size()) {
+        size_t r = rest.find(',', l);
+        if(r == std::string::npos)
+            r = rest.size();
+        m.args.push_back(trim(rest.substr(l, r - l)));
+        l = r + 1;
+    }
+    return m;
+}
+
+std::string MIPS::str() const {
+    if(!label.empty())
+        return label + ":";
+    if(!comment.empty())
+        return comment;
+    std::string s = op;
+    for(size_t i = 0; i < args.size(); ++i)
+        s += (i ? ", " : " ") + args[i];
+    return s;
+}
+
+bool MIPS::isBranch() const {
+    return invertBranch.find(op) != invertBranch.end();
+}
+
+bool MIPS::isJump() const {
+    return op == "j" || op == "b" || op == "jr";
+}
+
+bool MIPS::isCall() const {
+    return op == "jal" || op == "syscall";
+}
+
+bool MIPS::isLoad() const {
+    return loadOps.find(op) != loadOps.end();
+}
+
+bool MIPS::isStore() const {
+    return storeOps.find(op) != storeOps.end();
+}
+
+std::string MIPS::target() const {
+    if((isBranch() || op == "j" || op == "b" || op == "jal") && !args.empty())
+        return args.back();
+    return "";
+}
+
+std::string MIPS::base() const {
+    if(!isLoad() && !isStore())
+        return "";
+    const auto &a = args.back();
+    size_t l = a.find('('), r = a.find(')');
+    if(l == std::string::npos || r == std::string::npos)
+        return "";
+    return a.substr(l + 1, r - l - 1);
+}
+
+std::vector<std::string> MIPS::defs() const {
+    if(op == "mult" || op == "multu" || ((op == "div" || op == "divu") && args.size() == 2))
+        return {"$hi", "$lo"};
+    if(op == "jal") {
+        std::vector<std::string> d {"$ra", "$v0", "$v1"};
+        d.insert(d.end(), mipsArgRegs.begin(), mipsArgRegs.end());
+        return d;
+    }
+    if(op == "syscall")
+        return {"$v0"};
+    // the three operand forms go through HI/LO as well
+    if((op == "mul" || op == "div" || op == "divu" || op == "rem") && !args.empty())
+        return {args[0], "$hi", "$lo"};
+    if(dstFirstOps.find(op) != dstFirstOps.end() && !args.empty())
+        return {args[0]};
+    return {};
+}
+
+std::vector<std::string> MIPS::uses() const {
+    std::vector<std::string> u;
+    if(op == "mflo")
+        return {"$lo"};
+    if(op == "mfhi")
+        return {"$hi"};
+    if(op == "jal") {
+        std::vector<std::string> u(mipsArgRegs);
+        u.push_back("$sp");
+        return u;
+    }
+    if(op == "syscall")
+        return {"$v0", "$a0", "$a1"};
+    size_t from = dstFirstOps.find(op) != dstFirstOps.end()
+        || ((op == "div" || op == "divu") && args.size() == 3) ? 1 : 0;
+    for(size_t i = from; i < args.size(); ++i)
+    if(isReg(args[i]))
+        u.push_back(args[i]);
+    auto b = base();
+    if(!b.empty())
+        u.push_back(b);
+    return u;
+}
+
+static bool has(const std::vector<std::string> &v, const std::string &s) {
+    for(const auto &t : v)
+    if(t == s)
+        return true;
+    return false;
+}
+
+// next line that is not blank, labels included
+static size_t nextLine(const std::vector<MIPS> &code, size_t i) {
+    for(++i; i < code.size(); ++i)
+    if(code[i].isInst() || code[i].isLabel())
+        break;
+    return i;
+}
+
+// whether reg is written before being read on every path leaving line i;
+// anything the window can't follow counts as a read
+static bool deadAfter(const std::vector<MIPS> &code, size_t i, const std::string &reg) {
+    for(size_t k = nextLine(code, i); k < code.size(); k = nextLine(code, k)) {
+        const auto &m = code[k];
+        if(m.isLabel())
+            return false;
+        if(has(m.uses(), reg))
+            return false;
+        if(m.op == "jr")
+            return reg.substr(0, 2) == "$t";
+        if(m.isBranch() || m.isJump() || m.isCall())
+            return false;
+        if(has(m.defs(), reg))
+            return true;
+    }
+    return false;
+}
+
+static bool fitsImm16(int64_t v) {
+    return v >= -32768 && v <= 32767;
+}
+
+static bool isImm(const std::string &s) {
+    return !s.empty() && (isdigit(s[0]) || s[0] == '-');
+}
+
+size_t mipsLength(const MIPS &m) {
+    if(!m.isInst())
+        return 0;
+    // li and the $at loads of immediate operands
+    auto imm = [] (const std::string &v) -> size_t {
+        int64_t x = std::stoll(v, nullptr, 0);
+        return fitsImm16(x) || (x >= 0 && x <= 0xffff) ? 1 : 2;
+    };
+    if(m.op == "li")
+        return imm(m.args[1]);
+    if(m.op == "la")
+        return 2;
+    if(m.isLoad() || m.isStore()) {
+        const auto &a = m.args.back();
+        size_t l = a.find('(');
+        if(l == std::string::npos)
+            return 2;
+        std::string off = a.substr(0, l);
+        return off.empty() || (isImm(off) && fitsImm16(std::stoll(off))) ? 1 : 3;
+    }
+    if(m.op == "blt" || m.op == "ble" || m.op == "bgt" || m.op == "bge")
+        return isImm(m.args[1]) ? 1 + imm(m.args[1]) : 2;
+    if((m.op == "beq" || m.op == "bne") && isImm(m.args[1]))
+        return 1 + imm(m.args[1]);
+    if((m.op == "addiu" || m.op == "addi") && !fitsImm16(std::stoll(m.args[2], nullptr, 0)))
+        return 1 + imm(m.args[2]);
+    if((m.op == "addu" || m.op == "subu" || m.op == "mul") && m.args.size() == 3 && isImm(m.args[2]))
+        return 1 + imm(m.args[2]);
+    if((m.op == "div" || m.op == "divu" || m.op == "rem") && m.args.size() == 3)
+        return isImm(m.args[2]) ? 2 + imm(m.args[2]) : 4;
+    return 1;
+}
+
+size_t mipsCost(const MIPS &m) {
+    if(!m.isInst())
+        return 0;
+    // li takes lui + ori unless one instruction can build the value
+    if(m.op == "li") {
+        int64_t v = std::stoll(m.args[1], nullptr, 0);
+        return fitsImm16(v) || (v >= 0 && v <= 0xffff) ? 1 : 2;
+    }
+    size_t c = 1;
+    auto iter = costs.find(m.op);
+    if(iter != costs.end())
+        c = iter->second;
+    // three operand div/rem also move the result out of LO/HI
+    if((m.op == "div" || m.op == "divu" || m.op == "rem") && m.args.size() == 3)
+        ++c;
+    // an immediate operand of a register instruction is loaded into $at
+    if((m.op == "mul" || m.op == "div" || m.op == "rem") && m.args.size() == 3 && isImm(m.args[2]))
+        c += mipsCost(MIPS{"li", {"$at", m.args[2]}, "", ""});
+    return c;
+}
+
+// multiplier and shift for signed division by ad, 2 <= ad < 2^31
+// (Hacker's Delight, 10-1)
+static void divMagic(uint32_t ad, int32_t &M, int &s) {
+    const uint32_t two31 = 0x80000000u;
+    uint32_t anc = two31 - 1 - two31 % ad;
+    uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+    uint32_t delta;
+    int p = 31;
+    do {
+        ++p;
+        q1 *= 2;
+        r1 *= 2;
+        if(r1 >= anc) {
+            ++q1;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if(r2 >= ad) {
+            ++q2;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while(q1 < delta || (q1 == delta && r1 == 0));
+    M = (int32_t)(q2 + 1);
+    s = p - 32;
+}
+
+// dst = a / d truncated toward zero, $t9 is scratch, dst may equal a
+std::vector<std::string> mipsDivByConst(const std::string &dst, const std::string &a, int32_t d) {
+    std::vector<std::string> r;
+    uint32_t ad = d < 0 ? 0u - (uint32_t)d : (uint32_t)d;
+    if(ad == 1) {
+        r.push_back("move " + dst + ", " + a);
+    } else if((ad & (ad - 1)) == 0) {
+        int k = 0;
+        while((1u << k) != ad)
+            ++k;
+        // bias negative dividends by 2^k - 1 so the shift rounds toward zero
+        if(k == 1) {
+            r.push_back("srl $t9, " + a + ", 31");
+        } else {
+            r.push_back("sra $t9, " + a + ", 31");
+            r.push_back("srl $t9, $t9, " + std::to_string(32 - k));
+        }
+        r.push_back("addu $t9, " + a + ", $t9");
+        r.push_back("sra " + dst + ", $t9, " + std::to_string(k));
+    } else {
+        int32_t M;
+        int sh;
+        divMagic(ad, M, sh);
+        r.push_back("li $t9, " + std::to_string(M));
+        r.push_back("mult " + a + ", $t9");
+        r.push_back("mfhi $t9");
+        if(M < 0)
+            r.push_back("addu $t9, $t9, " + a);
+        if(sh > 0)
+            r.push_back("sra $t9, $t9, " + std::to_string(sh));
+        r.push_back("srl " + dst + ", " + a + ", 31");
+        r.push_back("addu " + dst + ", $t9, " + dst);
+    }
+    if(d < 0)
+        r.push_back("subu " + dst + ", $zero, " + dst);
+    return r;
+}
+
+// dst = a * c, $t9 is scratch, dst may equal a. Horner's rule over the
+// non-adjacent form of |c| gives one sll plus one addu/subu per nonzero
+// digit; it is used when the cost table rates it below li + mul
+std::vector<std::string> mipsMulByConst(const std::string &dst, const std::string &a, int32_t c) {
+    std::vector<std::string> r;
+    std::vector<std::string> fallback {
+        "li $t9, " + std::to_string(c),
+        "mul " + dst + ", " + a + ", $t9"
+    };
+    if(c == 0)
+        return {"li " + dst + ", 0"};
+    uint64_t u = c < 0 ? 0ull - (int64_t)c : (uint64_t)c;
+    std::vector<int> digit;
+    while(u) {
+        int x = 0;
+        if(u & 1) {
+            x = (u & 3) == 3 ? -1 : 1;
+            u -= x;
+        }
+        digit.push_back(x);
+        u >>= 1;
+    }
+    // a top digit at 2^32 can't be shifted into place
+    if(digit.size() > 32)
+        return fallback;
+    std::string cur = a;
+    size_t shift = 0;
+    for(size_t i = digit.size() - 1; i-- > 0; ) {
+        ++shift;
+        if(!digit[i])
+            continue;
+        r.push_back("sll $t9, " + cur + ", " + std::to_string(shift));
+        r.push_back(std::string(digit[i] > 0 ? "addu" : "subu") + " $t9, $t9, " + a);
+        cur = "$t9";
+        shift = 0;
+    }
+    if(shift)
+        r.push_back("sll $t9, " + cur + ", " + std::to_string(shift));
+    if(r.empty()) {
+        if(dst != a)
+            r.push_back("move $t9, " + a);
+    }
+    // the last step writes dst directly
+    if(!r.empty()) {
+        MIPS m = MIPS::parse(r.back());
+        m.args[0] = dst;
+        r.back() = m.str();
+    }
+    if(c < 0)
+        r.push_back("subu " + dst + ", $zero, " + dst);
+    size_t chain = 0, mul = 0;
+    for(const auto &line : r)
+        chain += mipsCost(MIPS::parse(line));
+    for(const auto &line : fallback)
+        mul += mipsCost(MIPS::parse(line));
+    return chain < mul ? r : fallback;
+}
+
+// dst = a % d with the sign of a, dst may equal a
+std::vector<std::string> mipsRemByConst(const std::string &dst, const std::string &a, int32_t d) {
+    std::vector<std::string> r;
+    uint32_t ad = d < 0 ? 0u - (uint32_t)d : (uint32_t)d;
+    if(ad > 1 && ad <= 0x10000 && (ad & (ad - 1)) == 0) {
+        int k = 0;
+        while((1u << k) != ad)
+            ++k;
+        // mask the biased dividend and take the bias back off
+        if(k == 1) {
+            r.push_back("srl $t9, " + a + ", 31");
+        } else {
+            r.push_back("sra $t9, " + a + ", 31");
+            r.push_back("srl $t9, $t9, " + std::to_string(32 - k));
+        }
+        r.push_back("addu " + dst + ", " + a + ", $t9");
+        r.push_back("andi " + dst + ", " + dst + ", " + std::to_string(ad - 1));
+        r.push_back("subu " + dst + ", " + dst + ", $t9");
+        return r;
+    }
+    if(dst == a) {
+        r.push_back("li $t9, " + std::to_string(d));
+        r.push_back("div " + a + ", $t9");
+        r.push_back("mfhi " + dst);
+        return r;
+    }
+    r = mipsDivByConst(dst, a, d);
+    for(const auto &line : mipsMulByConst(dst, dst, d))
+        r.push_back(line);
+    r.push_back("subu " + dst + ", " + a + ", " + dst);
+    return r;
+}
+
+void mipsPeephole(std::vector<MIPS> &code, std::map<std::string, size_t> &hits) {
+    struct Rule {
+        const char *name;
+        std::function<bool(std::vector<MIPS> &, size_t)> apply;
+    };
+
+    auto erase = [] (std::vector<MIPS> &c, size_t i) {
+        c.erase(c.begin() + (std::ptrdiff_t)i);
+    };
+
+    const std::vector<Rule> rules {
+        {"self-move", [&] (std::vector<MIPS> &c, size_t i) {
+            if(c[i].op != "move" || c[i].args[0] != c[i].args[1])
+                return false;
+            erase(c, i);
+            return true;
+        }},
+        {"store-load", [&] (std::vector<MIPS> &c, size_t i) {
+            size_t j = nextLine(c, i);
+            if(c[i].op != "sw" || j >= c.size() || c[j].op != "lw" || c[j].args[1] != c[i].args[1])
+                return false;
+            if(c[j].args[0] == c[i].args[0])
+                erase(c, j);
+            else
+                c[j] = MIPS{"move", {c[j].args[0], c[i].args[0]}, "", "", c[j].line};
+            return true;
+        }},
+        {"load-load", [&] (std::vector<MIPS> &c, size_t i) {
+            size_t j = nextLine(c, i);
+            if(!c[i].isLoad() || j >= c.size() || c[j].op != c[i].op || c[j].args[1] != c[i].args[1])
+                return false;
+            if(c[i].base() == c[i].args[0])
+                return false;
+            if(c[j].args[0] == c[i].args[0])
+                erase(c, j);
+            else
+                c[j] = MIPS{"move", {c[j].args[0], c[i].args[0]}, "", "", c[j].line};
+            return true;
+        }},
+        {"load-store", [&] (std::vector<MIPS> &c, size_t i) {
+            size_t j = nextLine(c, i);
+            if(!c[i].isLoad() || j >= c.size() || !c[j].isStore())
+                return false;
+            if(c[i].op.substr(1) != c[j].op.substr(1) || c[i].args != c[j].args || c[i].base() == c[i].args[0])
+                return false;
+            erase(c, j);
+            return true;
+        }},
+        {"store-store", [&] (std::vector<MIPS> &c, size_t i) {
+            size_t j = nextLine(c, i);
+            if(!c[i].isStore() || j >= c.size() || c[j].op != c[i].op || c[j].args[1] != c[i].args[1])
+                return false;
+            erase(c, i);
+            return true;
+        }},
+        {"li-alu", [&] (std::vector<MIPS> &c, size_t i) {
+            size_t j = nextLine(c, i);
+            if(c[i].op != "li" || j >= c.size())
+                return false;
+            const auto t = c[i].args[0];
+            auto &m = c[j];
+            if((m.op != "addu" && m.op != "subu") || !isReg(m.args[2]) || m.args[1] == m.args[2])
+                return false;
+            int64_t k = std::stoll(c[i].args[1], nullptr, 0);
+            std::string a;
+            if(m.args[2] == t)
+                a = m.args[1];
+            else if(m.op == "addu" && m.args[1] == t)
+                a = m.args[2];
+            else
+                return false;
+            if(m.op == "subu")
+                k = -k;
+            if(!fitsImm16(k) || (m.args[0] != t && !deadAfter(c, j, t)))
+                return false;
+            m = MIPS{"addiu", {m.args[0], a, std::to_string(k)}, "", "", m.line};
+            erase(c, i);
+            return true;
+        }},
+        {"fold-move", [&] (std::vector<MIPS> &c, size_t i) {
+            size_t j = nextLine(c, i);
+            if(j >= c.size() || c[j].op != "move")
+                return false;
+            const auto d = c[j].args[0], t = c[j].args[1];
+            auto &m = c[i];
+            if(dstFirstOps.find(m.op) == dstFirstOps.end() || m.op == "mflo" || m.op == "mfhi")
+                return false;
+            if(m.args.empty() || m.args[0] != t || t == d || !deadAfter(c, j, t))
+                return false;
+            m.args[0] = d;
+            erase(c, j);
+            return true;
+        }},
+        {"jump-next", [&] (std::vector<MIPS> &c, size_t i) {
+            if(c[i].op != "j" && c[i].op != "b" && !c[i].isBranch())
+                return false;
+            for(size_t j = nextLine(c, i); j < c.size() && c[j].isLabel(); j = nextLine(c, j)) {
+                if(c[j].label == c[i].target()) {
+                    erase(c, i);
+                    return true;
+                }
+            }
+            return false;
+        }},
+        {"branch-over-jump", [&] (std::vector<MIPS> &c, size_t i) {
+            size_t j = nextLine(c, i);
+            if(!c[i].isBranch() || j >= c.size() || (c[j].op != "j" && c[j].op != "b"))
+                return false;
+            for(size_t k = nextLine(c, j); k < c.size() && c[k].isLabel(); k = nextLine(c, k)) {
+                if(c[k].label == c[i].target()) {
+                    c[i].op = invertBranch.at(c[i].op);
+                    c[i].args.back() = c[j].target();
+                    erase(c, j);
+                    return true;
+                }
+            }
+            return false;
+        }},
+        {"unreachable", [&] (std::vector<MIPS> &c, size_t i) {
+            size_t j = nextLine(c, i);
+            if(!c[i].isJump() || j >= c.size() || !c[j].isInst())
+                return false;
+            erase(c, j);
+            return true;
+        }}
+    };
+
+    for(size_t i = 0; i < code.size(); ) {
+        bool hit = false;
+        if(code[i].isInst()) {
+            for(const auto &rule : rules) {
+                if(!rule.apply(code, i))
+                    continue;
+                #ifdef DEBUG
+                std::cerr << "Peephole " << rule.name << " at line " << i << std::endl;
+                #endif
+                ++hits[std::string("peephole.") + rule.name];
+                hit = true;
+                break;
+            }
+        }
+        if(!hit)
+            ++i;
+        else
+            i = i > 3 ? i - 3 : 0;
+    }
+}
+
+MIPSLatency::MIPSLatency(): cycles(latencyModels.at("r3000")) {}
+
+size_t MIPSLatency::of(const MIPS &m) const {
+    auto iter = cycles.find(m.op);
+    return iter == cycles.end() ? 1 : iter->second;
+}
+
+bool MIPSLatency::configure(const std::string &spec) {
+    size_t l = 0;
+    while(l <= spec.size()) {
+        size_t r = spec.find(',', l);
+        if(r == std::string::npos)
+            r = spec.size();
+        std::string item = trim(spec.substr(l, r - l));
+        l = r + 1;
+        if(item.empty())
+            continue;
+        size_t eq = item.find('=');
+        if(eq == std::string::npos) {
+            auto iter = latencyModels.find(item);
+            if(iter == latencyModels.end())
+                return false;
+            cycles = iter->second;
+            continue;
+        }
+        std::string op = item.substr(0, eq), v = item.substr(eq + 1);
+        if(op.empty() || v.empty() || v.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        cycles[op] = std::stoul(v);
+    }
+    return true;
+}
+
+// the memory a load or store touches: a data label, "$sp" for the frame
+// or empty when unknown; exact when off is the whole address past it
+static std::string memSymbol(const MIPS &m, int64_t &off, bool &exact) {
+    const auto &a = m.args.back();
+    size_t l = a.find('(');
+    std::string prefix = a.substr(0, l);
+    off = 0;
+    exact = l == std::string::npos;
+    size_t plus = prefix.find_first_of("+-", 1);
+    if(!prefix.empty() && (isalpha(prefix[0]) || prefix[0] == '_')) {
+        if(plus != std::string::npos)
+            off = std::stoll(prefix.substr(plus));
+        return prefix.substr(0, plus);
+    }
+    if(l != std::string::npos && m.base() == "$sp") {
+        off = prefix.empty() ? 0 : std::stoll(prefix);
+        exact = true;
+        return "$sp";
+    }
+    return "";
+}
+
+static int64_t memWidth(const MIPS &m) {
+    return m.op[1] == 'w' ? 4 : m.op[1] == 'h' ? 2 : 1;
+}
+
+static bool mayAlias(const MIPS &x, const MIPS &y) {
+    int64_t ox, oy;
+    bool ex, ey;
+    auto sx = memSymbol(x, ox, ex), sy = memSymbol(y, oy, ey);
+    if(sx.empty() || sy.empty())
+        return true;
+    if(sx != sy)
+        return false;
+    if(!ex || !ey)
+        return true;
+    return ox < oy + memWidth(y) && oy < ox + memWidth(x);
+}
+
+void mipsSchedule(std::vector<MIPS> &code, const MIPSLatency &lat,
+        std::map<std::string, size_t> &stats) {
+    auto region = [&] (size_t l, size_t r) {
+        size_t n = r - l;
+        if(n < 2)
+            return;
+        std::vector<MIPS> ins(code.begin() + (std::ptrdiff_t)l, code.begin() + (std::ptrdiff_t)r);
+        bool pinLast = ins.back().isBranch() || ins.back().isJump();
+
+        // dist[i][j]: cycles j has to wait after i, -1 when independent
+        std::vector<std::vector<int64_t>> dist(n, std::vector<int64_t>(n, -1));
+        for(size_t i = 0; i < n; ++i) {
+            auto di = ins[i].defs(), ui = ins[i].uses();
+            for(size_t j = i + 1; j < n; ++j) {
+                auto dj = ins[j].defs(), uj = ins[j].uses();
+                int64_t d = -1;
+                for(const auto &reg : di) {
+                    if(has(uj, reg))
+                        d = std::max(d, (int64_t)lat.of(ins[i]));
+                    if(has(dj, reg))
+                        d = std::max(d, (int64_t)1);
+                }
+                for(const auto &reg : ui)
+                if(has(dj, reg))
+                    d = std::max(d, (int64_t)0);
+                bool mi = ins[i].isLoad() || ins[i].isStore(), mj = ins[j].isLoad() || ins[j].isStore();
+                if(mi && mj && (ins[i].isStore() || ins[j].isStore()) && mayAlias(ins[i], ins[j]))
+                    d = std::max(d, (int64_t)(ins[i].isStore() && ins[j].isLoad() ? 1 : 0));
+                if(pinLast && j + 1 == n)
+                    d = std::max(d, (int64_t)0);
+                dist[i][j] = d;
+            }
+        }
+
+        // cycles an order takes when issued one instruction per cycle
+        auto timing = [&] (const std::vector<size_t> &order) {
+            std::vector<int64_t> at(n, 0);
+            int64_t t = 0;
+            for(size_t k : order) {
+                for(size_t p = 0; p < n; ++p)
+                if(dist[p][k] >= 0)
+                    t = std::max(t, at[p] + dist[p][k]);
+                at[k] = t++;
+            }
+            return t;
+        };
+
+        std::vector<int64_t> height(n, 0);
+        for(size_t i = n - 1; i < n; --i) {
+            height[i] = (int64_t)lat.of(ins[i]);
+            for(size_t j = i + 1; j < n; ++j)
+            if(dist[i][j] >= 0)
+                height[i] = std::max(height[i], dist[i][j] + height[j]);
+        }
+
+        std::vector<size_t> npred(n, 0), order;
+        std::vector<int64_t> earliest(n, 0);
+        std::vector<bool> done(n, false);
+        for(size_t i = 0; i < n; ++i)
+        for(size_t j = i + 1; j < n; ++j)
+        if(dist[i][j] >= 0)
+            ++npred[j];
+        int64_t cycle = 0;
+        while(order.size() < n) {
+            size_t best = n;
+            int64_t soonest = std::numeric_limits<int64_t>::max();
+            for(size_t i = 0; i < n; ++i) {
+                if(done[i] || npred[i])
+                    continue;
+                soonest = std::min(soonest, earliest[i]);
+                if(earliest[i] > cycle)
+                    continue;
+                if(best == n || height[i] > height[best])
+                    best = i;
+            }
+            if(best == n) {
+                cycle = soonest;
+                continue;
+            }
+            done[best] = true;
+            order.push_back(best);
+            for(size_t j = best + 1; j < n; ++j)
+            if(dist[best][j] >= 0) {
+                --npred[j];
+                earliest[j] = std::max(earliest[j], cycle + dist[best][j]);
+            }
+            ++cycle;
+        }
+
+        std::vector<size_t> original(n);
+        for(size_t i = 0; i < n; ++i)
+            original[i] = i;
+        int64_t before = timing(original), after = timing(order);
+        if(after >= before) {
+            stats["sched.stalls"] += (size_t)(before - (int64_t)n);
+            return;
+        }
+        #ifdef DEBUG
+        std::cerr << "Scheduled " << n << " instructions at line " << l << ": "
+            << before << " -> " << after << " cycles" << std::endl;
+        #endif
+        for(size_t k = 0; k < n; ++k) {
+            if(order[k] != k)
+                ++stats["sched.moved"];
+            code[l + k] = ins[order[k]];
+        }
+        stats["sched.saved"] += (size_t)(before - after);
+        stats["sched.stalls"] += (size_t)(after - (int64_t)n);
+    };
+
+    size_t l = 0;
+    for(size_t i = 0; i < code.size(); ++i) {
+        const auto &m = code[i];
+        if(m.isInst() && !m.isCall()) {
+            if(m.isBranch() || m.isJump()) {
+                region(l, i + 1);
+                l = i + 1;
+            }
+            continue;
+        }
+        region(l, i);
+        l = i + 1;
+    }
+    region(l, code.size());
+}
+
+void mipsFillDelaySlots(std::vector<MIPS> &code, std::map<std::string, size_t> &stats) {
+    auto hasSlot = [] (const MIPS &m) {
+        return m.isBranch() || m.isJump() || m.op == "jal";
+    };
+    // one machine instruction that doesn't transfer control
+    auto fitsAlone = [&] (const MIPS &m) {
+        return m.isInst() && !hasSlot(m) && !m.isCall() && m.op != "nop" && mipsLength(m) == 1;
+    };
+    auto touches = [] (const MIPS &m, const std::string &reg) {
+        return has(m.defs(), reg) || has(m.uses(), reg);
+    };
+    // whether x can be moved across y
+    auto independent = [&] (const MIPS &x, const MIPS &y) {
+        for(const auto &r : x.defs())
+        if(has(y.uses(), r) || has(y.defs(), r))
+            return false;
+        for(const auto &r : x.uses())
+        if(has(y.defs(), r))
+            return false;
+        bool mx = x.isLoad() || x.isStore(), my = y.isLoad() || y.isStore();
+        return !(mx && my && (x.isStore() || y.isStore()) && mayAlias(x, y));
+    };
+    // a branch has read its operands when the slot runs, jal has set $ra
+    auto fitsSlot = [&] (const MIPS &x, const MIPS &b) {
+        if(b.op == "jal")
+            return !touches(x, "$ra");
+        for(const auto &r : x.defs())
+        if(has(b.uses(), r))
+            return false;
+        return true;
+    };
+    auto findLabel = [&] (const std::string &l) {
+        for(size_t k = 0; k < code.size(); ++k)
+        if(code[k].label == l)
+            return k;
+        return code.size();
+    };
+    // first instruction at line k, looking through blanks and labels
+    auto firstInst = [&] (size_t k) {
+        while(k < code.size() && !code[k].isInst())
+            ++k;
+        return k;
+    };
+
+    std::set<std::string> names;
+    for(const auto &m : code)
+    if(m.isLabel())
+        names.insert(m.label);
+
+    for(size_t i = 0; i < code.size(); ++i) {
+        if(!code[i].isInst() || !hasSlot(code[i]))
+            continue;
+        ++stats["delay.slots"];
+        const MIPS b = code[i];
+
+        // an instruction from before the branch that can sink past it
+        size_t from = code.size();
+        for(size_t k = i - 1, seen = 0; k < i && seen < 16; --k) {
+            const auto &m = code[k];
+            if(m.isLabel() || hasSlot(m) || m.isCall())
+                break;
+            if(!m.isInst())
+                continue;
+            // the slot of an earlier branch stays where it is
+            size_t p = k - 1;
+            while(p < k && !code[p].isInst() && !code[p].isLabel())
+                --p;
+            if(p < k && code[p].isInst() && hasSlot(code[p]))
+                break;
+            ++seen;
+            if(!fitsAlone(m) || !fitsSlot(m, b))
+                continue;
+            bool ok = true;
+            for(size_t q = k + 1; q < i && ok; ++q)
+            if(code[q].isInst())
+                ok = independent(m, code[q]);
+            if(ok) {
+                from = k;
+                break;
+            }
+        }
+        if(from < code.size()) {
+            MIPS m = code[from];
+            code.erase(code.begin() + (std::ptrdiff_t)from);
+            code.insert(code.begin() + (std::ptrdiff_t)i, m);
+            ++stats["delay.filled"];
+            ++stats["delay.before"];
+            continue;
+        }
+
+        // a jump runs the first instruction of its target in the slot and
+        // continues behind it
+        size_t t = b.op == "j" || b.op == "b" ? findLabel(b.target()) : code.size();
+        size_t f = firstInst(t);
+        if(t < code.size() && f < code.size() && fitsAlone(code[f])) {
+            MIPS m = code[f];
+            std::string l;
+            if(f + 1 < code.size() && code[f + 1].isLabel()) {
+                l = code[f + 1].label;
+            } else {
+                l = b.target() + "_ds";
+                while(names.count(l))
+                    l += "_";
+                names.insert(l);
+                code.insert(code.begin() + (std::ptrdiff_t)f + 1, MIPS{"", {}, l, ""});
+                if(f + 1 <= i)
+                    ++i;
+            }
+            code[i].args.back() = l;
+            code.insert(code.begin() + (std::ptrdiff_t)i + 1, m);
+            ++i;
+            ++stats["delay.filled"];
+            ++stats["delay.target"];
+            continue;
+        }
+
+        // a conditional branch runs the first fall-through instruction
+        // when what it writes is dead at the target
+        t = b.isBranch() ? findLabel(b.target()) : code.size();
+        f = i + 1;
+        while(f < code.size() && !code[f].isInst() && !code[f].isLabel())
+            ++f;
+        if(t < code.size() && f < code.size() && fitsAlone(code[f])
+                && !code[f].isLoad() && !code[f].isStore()) {
+            bool ok = true;
+            for(const auto &r : code[f].defs())
+                ok = ok && deadAfter(code, t, r);
+            if(ok) {
+                MIPS m = code[f];
+                code.erase(code.begin() + (std::ptrdiff_t)f);
+                code.insert(code.begin() + (std::ptrdiff_t)i + 1, m);
+                ++i;
+                ++stats["delay.filled"];
+                ++stats["delay.fallthrough"];
+                continue;
+            }
+        }
+
+        code.insert(code.begin() + (std::ptrdiff_t)i + 1, MIPS{"nop", {}, "", "", code[i].line});
+        ++i;
+    }
+}
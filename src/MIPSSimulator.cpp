@@ -0,0 +1,911 @@
+#include "MIPSSimulator.h"
+
+#include <set>
+#include <sstream>
+#include <cstdlib>
+#include <iomanip>
+#include <algorithm>
+
+static const uint32_t textBase = 0x00400000, dataBase = 0x10010000,
+    stackTop = 0x80000000, stackSize = 4 << 20, spInit = 0x7fffeffc, gpInit = 0x10008000;
+
+enum Kind {
+    kli, kmove, kneg, knot,
+    kadd, ksub, kmul, kand, kor, kxor, knor, kslt, ksltu,
+    ksll, ksra, ksrl,
+    kmult, kmultu, kdiv, kdivu, kdiv3, kdivu3, krem, kremu, kmfhi, kmflo,
+    klw, klh, klhu, klb, klbu, ksw, ksh, ksb,
+    kbeq, kbne, kblt, kble, kbgt, kbge,
+    kj, kjal, kjr, kjalr, ksyscall, knop
+};
+
+static std::string trim(const std::string &s) {
+    size_t l = s.find_first_not_of(" \t\r"), r = s.find_last_not_of(" \t\r");
+    if(l == std::string::npos)
+        return "";
+    return s.substr(l, r - l + 1);
+}
+
+static bool isSymbolChar(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
+
+static bool parseReg(const std::string &s, uint8_t &r) {
+    static const char *names[] {
+        "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+        "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+        "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+        "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
+    };
+    if(s.size() < 2 || s[0] != '$')
+        return false;
+    std::string n = s.substr(1);
+    if(n == "s8")
+        n = "fp";
+    for(uint8_t i = 0; i < 32; ++i)
+    if(n == names[i] || n == std::to_string(i)) {
+        r = i;
+        return true;
+    }
+    return false;
+}
+
+static bool parseNumber(const std::string &s, int64_t &v) {
+    if(s.empty())
+        return false;
+    char *end;
+    v = strtoll(s.c_str(), &end, 0);
+    return !*end;
+}
+
+MIPSCostModel::MIPSCostModel(): cacheSize(4096), lineSize(16), ways(1), missPenalty(10),
+    mispredictPenalty(2), slotPenalty(1) {}
+
+bool MIPSCostModel::configure(const std::string &spec) {
+    std::map<std::string, size_t *> settings {
+        {"cache", &cacheSize}, {"line", &lineSize}, {"ways", &ways},
+        {"miss", &missPenalty}, {"mispredict", &mispredictPenalty}, {"slot", &slotPenalty}
+    };
+    size_t l = 0;
+    while(l <= spec.size()) {
+        size_t r = spec.find(',', l);
+        if(r == std::string::npos)
+            r = spec.size();
+        std::string item = trim(spec.substr(l, r - l));
+        l = r + 1;
+        size_t eq = item.find('=');
+        auto iter = settings.find(item.substr(0, eq));
+        if(eq == std::string::npos || iter == settings.end()) {
+            if(!latency.configure(item))
+                return false;
+            continue;
+        }
+        std::string v = item.substr(eq + 1);
+        if(v.empty() || v.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        *iter->second = std::stoul(v);
+    }
+    // whole sets of whole lines, a power of two bytes each
+    auto pow2 = [] (size_t x) {
+        return x && !(x & (x - 1));
+    };
+    return pow2(lineSize) && ways && cacheSize % (lineSize * ways) == 0 && cacheSize >= lineSize * ways;
+}
+
+MIPSSimulator::MIPSSimulator(): delayed(false), entry(0) {}
+
+bool MIPSSimulator::fault(const std::string &why) {
+    error = why;
+    return false;
+}
+
+uint8_t *MIPSSimulator::at(uint32_t addr, uint32_t size) {
+    std::ostringstream why;
+    if(addr % size) {
+        why << "unaligned address 0x" << std::hex << addr;
+        fault(why.str());
+        return nullptr;
+    }
+    if(addr >= dataBase && (uint64_t)addr + size <= dataBase + (uint64_t)data.size())
+        return &data[addr - dataBase];
+    if(addr >= stackTop - stackSize && (uint64_t)addr + size <= stackTop)
+        return &stack[addr - (stackTop - stackSize)];
+    why << "address 0x" << std::hex << addr << " out of range";
+    fault(why.str());
+    return nullptr;
+}
+
+bool MIPSSimulator::load(std::istream &s) {
+    code.clear();
+    lines.clear();
+    functions.clear();
+    sources.clear();
+    insts.clear();
+    symbols.clear();
+    data.clear();
+    delayed = false;
+    entry = 0;
+    error.clear();
+
+    std::map<std::string, size_t> textLabels;
+    bool inText = true;
+    std::string raw;
+    size_t no = 0, source = 0;
+    auto bad = [&] (const std::string &why) {
+        return fault("line " + std::to_string(no) + ": " + why);
+    };
+    auto align = [&] (size_t a) {
+        while(data.size() % a)
+            data.push_back(0);
+    };
+    while(std::getline(s, raw)) {
+        ++no;
+        int64_t v;
+        std::string note = trim(raw);
+        if(note.compare(0, 7, "# line ") == 0 && parseNumber(note.substr(7), v) && v >= 0)
+            source = (size_t)v;
+        bool quoted = false;
+        for(size_t i = 0; i < raw.size(); ++i) {
+            if(raw[i] == '"' && (i == 0 || raw[i - 1] != '\\'))
+                quoted = !quoted;
+            else if(raw[i] == '#' && !quoted) {
+                raw.resize(i);
+                break;
+            }
+        }
+        std::string line = trim(raw);
+        // any number of labels may lead a line
+        while(true) {
+            size_t c = 0;
+            while(c < line.size() && isSymbolChar(line[c]))
+                ++c;
+            if(c == 0 || c >= line.size() || line[c] != ':')
+                break;
+            std::string name = line.substr(0, c);
+            if(symbols.count(name) || textLabels.count(name))
+                return bad("label " + name + " defined twice");
+            if(inText)
+                textLabels[name] = code.size();
+            else
+                symbols[name] = dataBase + (uint32_t)data.size();
+            line = trim(line.substr(c + 1));
+        }
+        if(line.empty())
+            continue;
+        if(line[0] == '.') {
+            size_t sp = line.find_first_of(" \t");
+            std::string dir = line.substr(0, sp), rest = sp == std::string::npos ? "" : trim(line.substr(sp));
+            if(dir == ".data") {
+                inText = false;
+            } else if(dir == ".text") {
+                inText = true;
+            } else if(dir == ".globl") {
+            } else if(dir == ".set") {
+                if(rest == "noreorder")
+                    delayed = true;
+                else if(rest == "reorder")
+                    delayed = false;
+            } else if(inText) {
+                return bad("directive " + dir + " in .text");
+            } else if(dir == ".space") {
+                if(!parseNumber(rest, v) || v < 0)
+                    return bad("bad size " + rest);
+                data.resize(data.size() + (size_t)v, 0);
+            } else if(dir == ".align") {
+                if(!parseNumber(rest, v) || v < 0 || v > 12)
+                    return bad("bad alignment " + rest);
+                align((size_t)1 << v);
+            } else if(dir == ".ascii" || dir == ".asciiz") {
+                if(rest.size() < 2 || rest.front() != '"' || rest.back() != '"')
+                    return bad("bad string " + rest);
+                for(size_t i = 1; i + 1 < rest.size(); ++i) {
+                    char c = rest[i];
+                    if(c == '\\' && i + 2 < rest.size()) {
+                        switch(rest[++i]) {
+                        case 'n': c = '\n'; break;
+                        case 't': c = '\t'; break;
+                        case 'r': c = '\r'; break;
+                        case '0': c = '\0'; break;
+                        default: c = rest[i]; break;
+                        }
+                    }
+                    data.push_back((uint8_t)c);
+                }
+                if(dir == ".asciiz")
+                    data.push_back(0);
+            } else if(dir == ".word" || dir == ".byte") {
+                size_t width = dir == ".word" ? 4 : 1;
+                align(width);
+                MIPS list = MIPS::parse("x " + rest);
+                for(const auto &item : list.args) {
+                    if(!parseNumber(item, v))
+                        return bad("bad value " + item);
+                    for(size_t k = 0; k < width; ++k)
+                        data.push_back((uint8_t)((uint64_t)v >> (8 * k)));
+                }
+            } else {
+                return bad("unknown directive " + dir);
+            }
+            continue;
+        }
+        if(!inText)
+            return bad("instruction in .data");
+        code.push_back(MIPS::parse(line));
+        lines.push_back(no);
+        sources.push_back(source);
+    }
+    for(const auto &item : textLabels)
+        symbols[item.first] = textBase + 4 * (uint32_t)item.second;
+
+    static const std::map<std::string, int> kinds {
+        {"li", kli}, {"lui", kli}, {"la", kadd},
+        {"move", kmove}, {"neg", kneg}, {"negu", kneg}, {"not", knot},
+        {"addu", kadd}, {"add", kadd}, {"addiu", kadd}, {"addi", kadd},
+        {"subu", ksub}, {"sub", ksub}, {"mul", kmul},
+        {"and", kand}, {"andi", kand}, {"or", kor}, {"ori", kor},
+        {"xor", kxor}, {"xori", kxor}, {"nor", knor},
+        {"slt", kslt}, {"slti", kslt}, {"sltu", ksltu}, {"sltiu", ksltu},
+        {"sll", ksll}, {"sllv", ksll}, {"sra", ksra}, {"srav", ksra}, {"srl", ksrl}, {"srlv", ksrl},
+        {"mult", kmult}, {"multu", kmultu}, {"div", kdiv}, {"divu", kdivu},
+        {"rem", krem}, {"remu", kremu}, {"mfhi", kmfhi}, {"mflo", kmflo},
+        {"lw", klw}, {"lh", klh}, {"lhu", klhu}, {"lb", klb}, {"lbu", klbu},
+        {"sw", ksw}, {"sh", ksh}, {"sb", ksb},
+        {"beq", kbeq}, {"bne", kbne}, {"blt", kblt}, {"ble", kble}, {"bgt", kbgt}, {"bge", kbge},
+        {"beqz", kbeq}, {"bnez", kbne}, {"bltz", kblt}, {"blez", kble}, {"bgtz", kbgt}, {"bgez", kbge},
+        {"j", kj}, {"b", kj}, {"jal", kjal}, {"jr", kjr}, {"jalr", kjalr},
+        {"syscall", ksyscall}, {"nop", knop}
+    };
+    // a number, a symbol or a symbol plus or minus a number
+    auto value = [&] (const std::string &a, int32_t &v) {
+        int64_t x;
+        if(parseNumber(a, x)) {
+            v = (int32_t)(uint32_t)(uint64_t)x;
+            return true;
+        }
+        size_t c = 0;
+        while(c < a.size() && isSymbolChar(a[c]))
+            ++c;
+        auto iter = symbols.find(a.substr(0, c));
+        if(c == 0 || iter == symbols.end())
+            return false;
+        x = 0;
+        if(c < a.size() && ((a[c] != '+' && a[c] != '-') || !parseNumber(a.substr(c), x)))
+            return false;
+        v = (int32_t)(uint32_t)(iter->second + (uint64_t)x);
+        return true;
+    };
+    // "off(reg)", "(reg)" or an absolute address
+    auto memory = [&] (const std::string &a, Inst &inst) {
+        size_t l = a.find('(');
+        inst.s = 0;
+        inst.imm = 0;
+        if(l == std::string::npos)
+            return value(a, inst.imm);
+        if(a.back() != ')' || !parseReg(a.substr(l + 1, a.size() - l - 2), inst.s))
+            return false;
+        return l == 0 || value(a.substr(0, l), inst.imm);
+    };
+
+    for(size_t i = 0; i < code.size(); ++i) {
+        const MIPS &m = code[i];
+        const auto &a = m.args;
+        no = lines[i];
+        auto iter = kinds.find(m.op);
+        if(iter == kinds.end())
+            return bad("unknown instruction " + m.op);
+        Inst inst {iter->second, 0, 0, 0, false, 0, 0, 0, {}, {}};
+        // the last operand, a register or an immediate
+        auto operand = [&] (const std::string &s) {
+            if(parseReg(s, inst.t))
+                return true;
+            inst.useImm = true;
+            return value(s, inst.imm);
+        };
+        auto label = [&] (const std::string &s) {
+            auto jter = textLabels.find(s);
+            if(jter == textLabels.end())
+                return false;
+            inst.target = jter->second;
+            return true;
+        };
+        bool ok;
+        switch(inst.kind) {
+        case kli:
+            ok = a.size() == 2 && parseReg(a[0], inst.d) && value(a[1], inst.imm);
+            inst.useImm = true;
+            if(m.op == "lui")
+                inst.imm = (int32_t)((uint32_t)inst.imm << 16);
+            break;
+        case kmove:
+        case kneg:
+        case knot:
+            ok = a.size() == 2 && parseReg(a[0], inst.d) && parseReg(a[1], inst.s);
+            break;
+        case kmfhi:
+        case kmflo:
+            ok = a.size() == 1 && parseReg(a[0], inst.d);
+            break;
+        case kmult:
+        case kmultu:
+            ok = a.size() == 2 && parseReg(a[0], inst.s) && parseReg(a[1], inst.t);
+            break;
+        case kdiv:
+        case kdivu:
+            if(a.size() == 2) {
+                ok = parseReg(a[0], inst.s) && parseReg(a[1], inst.t);
+                break;
+            }
+            inst.kind = inst.kind == kdiv ? kdiv3 : kdivu3;
+            ok = a.size() == 3 && parseReg(a[0], inst.d) && parseReg(a[1], inst.s) && operand(a[2]);
+            break;
+        case klw:
+        case klh:
+        case klhu:
+        case klb:
+        case klbu:
+        case ksw:
+        case ksh:
+        case ksb:
+            ok = a.size() == 2 && parseReg(a[0], inst.d) && memory(a[1], inst);
+            break;
+        case kbeq:
+        case kbne:
+        case kblt:
+        case kble:
+        case kbgt:
+        case kbge:
+            if(m.op.back() == 'z') {
+                inst.useImm = true;
+                ok = a.size() == 2 && parseReg(a[0], inst.s) && label(a[1]);
+            } else {
+                ok = a.size() == 3 && parseReg(a[0], inst.s) && operand(a[1]) && label(a[2]);
+            }
+            break;
+        case kj:
+        case kjal:
+            ok = a.size() == 1 && label(a[0]);
+            break;
+        case kjr:
+        case kjalr:
+            inst.d = 31;
+            ok = a.size() == 1 && parseReg(a[0], inst.s);
+            break;
+        case ksyscall:
+        case knop:
+            ok = a.empty();
+            break;
+        default:
+            if(m.op == "la") {
+                ok = a.size() == 2 && parseReg(a[0], inst.d) && memory(a[1], inst);
+                inst.useImm = true;
+                break;
+            }
+            ok = a.size() == 3 && parseReg(a[0], inst.d) && parseReg(a[1], inst.s) && operand(a[2]);
+            // the logical immediates are zero extended
+            if(ok && inst.useImm && (m.op == "andi" || m.op == "ori" || m.op == "xori"))
+                inst.imm &= 0xffff;
+            break;
+        }
+        // the immediate forms take numbers only
+        int64_t x;
+        if(ok && (m.op == "li" || m.op == "lui" || m.op == "addiu" || m.op == "addi"))
+            ok = parseNumber(a.back(), x);
+        if(!ok)
+            return bad("bad operands of " + m.str());
+        inst.length = (uint32_t)mipsLength(m);
+        auto index = [] (const std::string &r, std::vector<uint8_t> &to) {
+            uint8_t k;
+            if(r == "$hi")
+                to.push_back(32);
+            else if(r == "$lo")
+                to.push_back(33);
+            else if(parseReg(r, k))
+                to.push_back(k);
+        };
+        for(const auto &r : m.uses())
+            index(r, inst.uses);
+        for(const auto &r : m.defs())
+            index(r, inst.defs);
+        insts.push_back(inst);
+    }
+    auto main = textLabels.find("main");
+    if(main != textLabels.end())
+        entry = main->second;
+
+    // main and whatever is called start functions
+    std::map<size_t, std::string> starts;
+    starts[entry] = main != textLabels.end() ? "main" : "";
+    for(size_t i = 0; i < insts.size(); ++i)
+    if(insts[i].kind == kjal)
+        starts[insts[i].target] = code[i].args[0];
+    std::string name;
+    for(size_t i = 0; i < insts.size(); ++i) {
+        auto iter = starts.find(i);
+        if(iter != starts.end())
+            name = iter->second;
+        functions.push_back(name);
+    }
+    return true;
+}
+
+bool MIPSSimulator::run(std::istream &in, std::ostream &out, uint64_t limit) {
+    size_t n = insts.size();
+    counts.assign(n, LineCounts{0, 0, 0, 0, 0, 0, 0, 0});
+    stack.assign(stackSize, 0);
+    std::vector<uint8_t> image(data);
+    data.swap(image);
+
+    int32_t r[32] = {0}, hi = 0, lo = 0;
+    r[28] = (int32_t)gpInit;
+    r[29] = (int32_t)spInit;
+    auto add = [] (int32_t a, int32_t b) {
+        return (int32_t)((uint32_t)a + (uint32_t)b);
+    };
+
+    // the cycle when each register's value can be used, and the cache
+    std::vector<uint64_t> lat(n);
+    for(size_t i = 0; i < n; ++i)
+        lat[i] = cost.latency.of(code[i]);
+    uint64_t now = 0, ready[34] = {0}, clock = 0;
+    size_t sets = cost.cacheSize / (cost.lineSize * cost.ways);
+    std::vector<uint64_t> tags(sets * cost.ways, 0), used(sets * cost.ways, 0);
+    auto cached = [&] (uint32_t addr) {
+        uint64_t tag = addr / cost.lineSize + 1;
+        size_t set = (size_t)((tag - 1) % sets) * cost.ways, victim = set;
+        ++clock;
+        for(size_t w = set; w < set + cost.ways; ++w) {
+            if(tags[w] == tag) {
+                used[w] = clock;
+                return true;
+            }
+            if(used[w] < used[victim])
+                victim = w;
+        }
+        tags[victim] = tag;
+        used[victim] = clock;
+        return false;
+    };
+
+    // the call tree: a jal enters a child of the current node once its
+    // target runs, getting back to the line after it leaves again, and
+    // landing in another function by anything else is a tail call
+    const size_t none = (size_t)-1;
+    frames.assign(1, Frame{n ? functions[entry] : "", none, {}, {}});
+    auto callee = [&] (size_t parent, const std::string &f) {
+        auto iter = frames[parent].callees.find(f);
+        if(iter != frames[parent].callees.end())
+            return iter->second;
+        frames.push_back(Frame{f, parent, {}, {}});
+        frames[parent].callees[f] = frames.size() - 1;
+        return frames.size() - 1;
+    };
+    size_t frame = 0, callTo = n;
+    std::vector<size_t> returns;
+    bool returning = false;
+
+    // where a delayed branch goes once its slot ran, if it is taken
+    size_t pc = entry, pending = n;
+    bool slot = false, pendingJump = false, ok = true, halt = false;
+    uint64_t executed = 0;
+    while(pc < n) {
+        if(limit && executed == limit) {
+            ok = fault("stopped after " + std::to_string(limit) + " instructions");
+            break;
+        }
+        ++executed;
+        if(pc == callTo) {
+            frame = callee(frame, functions[pc]);
+            callTo = n;
+        } else if(returning && !returns.empty() && returns.back() == pc) {
+            returns.pop_back();
+            frame = frames[frame].parent;
+            returning = false;
+        } else if(functions[pc] != frames[frame].function && frames[frame].parent != none) {
+            frame = callee(frames[frame].parent, functions[pc]);
+        }
+        const Inst &I = insts[pc];
+        LineCounts &c = counts[pc];
+        ++c.runs;
+        int32_t vs = r[I.s], vt = I.useImm ? I.imm : r[I.t];
+        size_t next = pc + 1, to = n;
+        bool transfer = false, jumps = false;
+        uint8_t *p = nullptr;
+        uint32_t addr = 0;
+        bool accessed = false;
+        auto address = [&] (uint32_t size) {
+            addr = (uint32_t)add(vs, I.imm);
+            p = at(addr, size);
+            accessed = p != nullptr;
+            return accessed;
+        };
+        auto branch = [&] (bool cond) {
+            transfer = true;
+            if(cond) {
+                jumps = true;
+                to = I.target;
+                ++c.taken;
+            }
+        };
+        auto jumpTo = [&] (int32_t addr) {
+            uint32_t a = (uint32_t)addr;
+            transfer = jumps = true;
+            if(a < textBase || (a - textBase) % 4 || (a - textBase) / 4 > n) {
+                std::ostringstream why;
+                why << "jump to 0x" << std::hex << a;
+                return fault(why.str());
+            }
+            to = (a - textBase) / 4;
+            return true;
+        };
+        switch(I.kind) {
+        case kli: r[I.d] = I.imm; break;
+        case kmove: r[I.d] = vs; break;
+        case kneg: r[I.d] = (int32_t)(0u - (uint32_t)vs); break;
+        case knot: r[I.d] = ~vs; break;
+        case kadd: r[I.d] = add(vs, vt); break;
+        case ksub: r[I.d] = (int32_t)((uint32_t)vs - (uint32_t)vt); break;
+        case kmul: r[I.d] = (int32_t)((uint32_t)vs * (uint32_t)vt); break;
+        case kand: r[I.d] = vs & vt; break;
+        case kor: r[I.d] = vs | vt; break;
+        case kxor: r[I.d] = vs ^ vt; break;
+        case knor: r[I.d] = ~(vs | vt); break;
+        case kslt: r[I.d] = vs < vt; break;
+        case ksltu: r[I.d] = (uint32_t)vs < (uint32_t)vt; break;
+        case ksll: r[I.d] = (int32_t)((uint32_t)vs << (vt & 31)); break;
+        case ksra: r[I.d] = vs >> (vt & 31); break;
+        case ksrl: r[I.d] = (int32_t)((uint32_t)vs >> (vt & 31)); break;
+        case kmult:
+        case kmultu: {
+            uint64_t prod = I.kind == kmult ? (uint64_t)((int64_t)vs * vt) : (uint64_t)(uint32_t)vs * (uint32_t)vt;
+            lo = (int32_t)(uint32_t)prod;
+            hi = (int32_t)(uint32_t)(prod >> 32);
+            break;
+        }
+        case kdiv:
+        case kdivu:
+        case kdiv3:
+        case kdivu3:
+        case krem:
+        case kremu:
+            // the two operand forms leave HI and LO alone, the pseudo
+            // instructions check for zero the way MARS expands them
+            if(vt == 0) {
+                if(I.kind == kdiv || I.kind == kdivu)
+                    break;
+                ok = fault("division by zero");
+                break;
+            }
+            if(I.kind == kdivu || I.kind == kdivu3 || I.kind == kremu) {
+                lo = (int32_t)((uint32_t)vs / (uint32_t)vt);
+                hi = (int32_t)((uint32_t)vs % (uint32_t)vt);
+            } else if(vs == INT32_MIN && vt == -1) {
+                lo = vs;
+                hi = 0;
+            } else {
+                lo = vs / vt;
+                hi = vs % vt;
+            }
+            if(I.kind == kdiv3 || I.kind == kdivu3)
+                r[I.d] = lo;
+            else if(I.kind == krem || I.kind == kremu)
+                r[I.d] = hi;
+            break;
+        case kmfhi: r[I.d] = hi; break;
+        case kmflo: r[I.d] = lo; break;
+        case klw:
+            if((ok = address(4)))
+                r[I.d] = (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+            break;
+        case klh:
+        case klhu:
+            if((ok = address(2))) {
+                uint16_t h = (uint16_t)(p[0] | p[1] << 8);
+                r[I.d] = I.kind == klh ? (int16_t)h : (int32_t)h;
+            }
+            break;
+        case klb:
+        case klbu:
+            if((ok = address(1)))
+                r[I.d] = I.kind == klb ? (int8_t)p[0] : (int32_t)p[0];
+            break;
+        case ksw:
+        case ksh:
+        case ksb: {
+            uint32_t size = I.kind == ksw ? 4 : I.kind == ksh ? 2 : 1;
+            if((ok = address(size)))
+            for(uint32_t k = 0; k < size; ++k)
+                p[k] = (uint8_t)((uint32_t)r[I.d] >> (8 * k));
+            break;
+        }
+        case kbeq: branch(vs == vt); break;
+        case kbne: branch(vs != vt); break;
+        case kblt: branch(vs < vt); break;
+        case kble: branch(vs <= vt); break;
+        case kbgt: branch(vs > vt); break;
+        case kbge: branch(vs >= vt); break;
+        case kj:
+            transfer = jumps = true;
+            to = I.target;
+            break;
+        case kjal:
+            transfer = jumps = true;
+            to = I.target;
+            r[31] = (int32_t)(textBase + 4 * (uint32_t)(pc + (delayed ? 2 : 1)));
+            callTo = I.target;
+            returns.push_back(pc + (delayed ? 2 : 1));
+            returning = false;
+            break;
+        case kjr:
+        case kjalr:
+            ok = jumpTo(vs);
+            returning = I.kind == kjr;
+            if(I.kind == kjalr) {
+                r[I.d] = (int32_t)(textBase + 4 * (uint32_t)(pc + (delayed ? 2 : 1)));
+                callTo = to;
+                returns.push_back(pc + (delayed ? 2 : 1));
+            }
+            break;
+        case ksyscall:
+            switch(r[2]) {
+            case 1:
+                out << r[4];
+                break;
+            case 4:
+                for(uint32_t a = (uint32_t)r[4]; (p = at(a, 1)) && *p; ++a)
+                    out.put((char)*p);
+                ok = p != nullptr;
+                break;
+            case 5: {
+                long long v;
+                if(!(in >> v))
+                    ok = fault("no integer to read");
+                r[2] = (int32_t)(uint32_t)(unsigned long long)v;
+                break;
+            }
+            case 11:
+                out.put((char)r[4]);
+                break;
+            case 12: {
+                char c = 0;
+                if(!(in.get(c)))
+                    ok = fault("no character to read");
+                r[2] = (unsigned char)c;
+                break;
+            }
+            case 10:
+            case 17:
+                halt = true;
+                break;
+            default:
+                ok = fault("unsupported syscall " + std::to_string(r[2]));
+                break;
+            }
+            break;
+        case knop:
+            break;
+        }
+        r[0] = 0;
+
+        // wait for the operands, issue every machine instruction, then pay
+        // for a miss and for the branch
+        uint64_t start = now, issue = now;
+        for(uint8_t u : I.uses)
+            issue = std::max(issue, ready[u]);
+        c.dataStall += issue - now;
+        now = issue + I.length;
+        for(uint8_t d : I.defs)
+            ready[d] = issue + I.length - 1 + lat[pc];
+        if(accessed) {
+            ++c.accesses;
+            if(!cached(addr)) {
+                ++c.misses;
+                c.cacheStall += cost.missPenalty;
+                now += cost.missPenalty;
+                for(uint8_t d : I.defs)
+                    ready[d] += cost.missPenalty;
+            }
+        }
+        if(transfer) {
+            uint64_t penalty = delayed ? 0 : cost.slotPenalty;
+            if(I.kind >= kbeq && I.kind <= kbge && jumps != (I.target <= pc))
+                penalty += cost.mispredictPenalty;
+            c.branchStall += penalty;
+            now += penalty;
+        }
+        c.cycles += now - start;
+        frames[frame].cycles[sources[pc]] += now - start;
+
+        if(!ok || halt)
+            break;
+        if(delayed) {
+            // the line after a branch runs before it takes effect
+            if(slot) {
+                slot = false;
+                if(pendingJump)
+                    next = pending;
+            }
+            if(transfer) {
+                slot = true;
+                pendingJump = jumps;
+                pending = to;
+            }
+        } else if(jumps) {
+            next = to;
+        }
+        pc = next;
+    }
+    out.flush();
+    data.swap(image);
+    if(!ok)
+        error = "line " + std::to_string(lines[pc]) + ": " + error;
+    return ok;
+}
+
+std::map<std::string, uint64_t> MIPSSimulator::byClass() const {
+    static const std::set<std::string> mulDivOps {
+        "mul", "mult", "multu", "div", "divu", "rem", "remu", "mfhi", "mflo"
+    };
+    std::map<std::string, uint64_t> res;
+    for(size_t i = 0; i < counts.size(); ++i) {
+        const MIPS &m = code[i];
+        uint64_t runs = counts[i].runs;
+        std::string cls = "alu";
+        if(m.op == "syscall")
+            cls = "syscall";
+        else if(m.op == "jal" || m.op == "jalr")
+            cls = "call";
+        else if(m.isBranch())
+            cls = "branch";
+        else if(m.isJump())
+            cls = "jump";
+        else if(m.isLoad())
+            cls = "load";
+        else if(m.isStore())
+            cls = "store";
+        else if(mulDivOps.count(m.op))
+            cls = "muldiv";
+        else if(m.op == "nop")
+            cls = "nop";
+        res[cls] += runs;
+        res["taken"] += counts[i].taken;
+        res["total"] += runs;
+        res["machine"] += runs * insts[i].length;
+    }
+    return res;
+}
+
+std::map<std::string, MIPSSimulator::LineCounts> MIPSSimulator::byFunction() const {
+    std::map<std::string, LineCounts> res;
+    for(size_t i = 0; i < counts.size(); ++i) {
+        auto &f = res.insert({functions[i], LineCounts{0, 0, 0, 0, 0, 0, 0, 0}}).first->second;
+        const auto &c = counts[i];
+        f.runs += c.runs;
+        f.taken += c.taken;
+        f.cycles += c.cycles;
+        f.accesses += c.accesses;
+        f.misses += c.misses;
+        f.dataStall += c.dataStall;
+        f.cacheStall += c.cacheStall;
+        f.branchStall += c.branchStall;
+    }
+    return res;
+}
+
+std::map<std::pair<std::string, size_t>, MIPSSimulator::LineCounts> MIPSSimulator::bySource() const {
+    std::map<std::pair<std::string, size_t>, LineCounts> res;
+    for(size_t i = 0; i < counts.size(); ++i) {
+        auto &f = res.insert({{functions[i], sources[i]}, LineCounts{0, 0, 0, 0, 0, 0, 0, 0}}).first->second;
+        const auto &c = counts[i];
+        f.runs += c.runs;
+        f.taken += c.taken;
+        f.cycles += c.cycles;
+        f.accesses += c.accesses;
+        f.misses += c.misses;
+        f.dataStall += c.dataStall;
+        f.cacheStall += c.cacheStall;
+        f.branchStall += c.branchStall;
+    }
+    return res;
+}
+
+// functions by the name they have in the source
+static std::string sourceName(const std::string &label) {
+    if(label.empty())
+        return "(start)";
+    return label.compare(0, 7, "__func_") == 0 ? label.substr(7) : label;
+}
+
+void MIPSSimulator::collapsedStacks(std::ostream &s) const {
+    for(size_t k = 0; k < frames.size(); ++k) {
+        std::string stack;
+        for(size_t f = k; f != (size_t)-1; f = frames[f].parent)
+            stack = sourceName(frames[f].function) + (stack.empty() ? "" : ";") + stack;
+        for(const auto &item : frames[k].cycles) {
+            if(!item.second)
+                continue;
+            s << stack;
+            if(item.first)
+                s << ";" << sourceName(frames[k].function) << ":" << item.first;
+            s << " " << item.second << std::endl;
+        }
+    }
+}
+
+void MIPSSimulator::report(std::ostream &s) const {
+    auto percent = [] (uint64_t a, uint64_t b) {
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(1) << (b ? 100.0 * (double)a / (double)b : 0.0) << "%";
+        return ss.str();
+    };
+    auto row = [&] (const std::string &key, uint64_t v, const std::string &note) {
+        s << std::left << std::setw(10) << key << std::right << std::setw(14) << v;
+        if(!note.empty())
+            s << "  " << note;
+        s << std::endl;
+    };
+
+    auto c = byClass();
+    uint64_t total = c["total"];
+    s << "# instructions run" << std::endl;
+    for(const char *cls : {"alu", "muldiv", "load", "store", "branch", "jump", "call", "syscall", "nop"})
+        row(cls, c[cls], percent(c[cls], total));
+    row("taken", c["taken"], "of the branches");
+    row("total", total, "");
+    row("machine", c["machine"], "pseudo-instructions expanded");
+
+    // the whole program is the sum of its functions
+    auto functions = byFunction();
+    LineCounts all {0, 0, 0, 0, 0, 0, 0, 0};
+    for(const auto &item : functions) {
+        all.cycles += item.second.cycles;
+        all.accesses += item.second.accesses;
+        all.misses += item.second.misses;
+        all.dataStall += item.second.dataStall;
+        all.cacheStall += item.second.cacheStall;
+        all.branchStall += item.second.branchStall;
+    }
+    std::ostringstream cpi;
+    cpi << std::fixed << std::setprecision(2) << (c["machine"] ? (double)all.cycles / (double)c["machine"] : 0.0);
+    s << "# cycles" << std::endl;
+    row("cycles", all.cycles, cpi.str() + " per machine instruction");
+    row("operands", all.dataStall, percent(all.dataStall, all.cycles) + " waiting for results");
+    row("cache", all.cacheStall, percent(all.cacheStall, all.cycles) + " on misses");
+    row("branches", all.branchStall, percent(all.branchStall, all.cycles) + " on mispredictions and delay slots");
+    s << "# data cache, " << cost.cacheSize << " bytes, " << cost.lineSize << " byte lines, "
+        << cost.ways << (cost.ways == 1 ? " way" : " ways") << std::endl;
+    row("accesses", all.accesses, "");
+    row("misses", all.misses, percent(all.misses, all.accesses));
+
+    std::vector<std::pair<std::string, LineCounts>> order(functions.begin(), functions.end());
+    std::stable_sort(order.begin(), order.end(), [] (const std::pair<std::string, LineCounts> &a, const std::pair<std::string, LineCounts> &b) {
+        return a.second.cycles > b.second.cycles;
+    });
+    s << "# by function: instructions, cycles, stalls on operands, cache and branches, misses" << std::endl;
+    for(const auto &item : order) {
+        const auto &f = item.second;
+        if(!f.runs)
+            continue;
+        s << std::left << std::setw(24) << (item.first.empty() ? "(start)" : item.first) << std::right
+            << std::setw(12) << f.runs << std::setw(12) << f.cycles << std::setw(8) << percent(f.cycles, all.cycles)
+            << std::setw(10) << f.dataStall << std::setw(10) << f.cacheStall << std::setw(10) << f.branchStall
+            << std::setw(10) << f.misses << std::setw(8) << percent(f.misses, f.accesses) << std::endl;
+    }
+
+    // only code built with -g knows its source lines
+    if(std::none_of(sources.begin(), sources.end(), [] (size_t l) { return l != 0; }))
+        return;
+    auto lines = bySource();
+    std::vector<std::pair<std::pair<std::string, size_t>, LineCounts>> hot(lines.begin(), lines.end());
+    std::stable_sort(hot.begin(), hot.end(), [] (const std::pair<std::pair<std::string, size_t>, LineCounts> &a,
+            const std::pair<std::pair<std::string, size_t>, LineCounts> &b) {
+        return a.second.cycles > b.second.cycles;
+    });
+    s << "# hot source lines: instructions, cycles, stalls on operands, cache and branches" << std::endl;
+    for(size_t k = 0; k < hot.size() && k < 10 && hot[k].second.cycles; ++k) {
+        const auto &f = hot[k].second;
+        std::string where = sourceName(hot[k].first.first) + ":" + (hot[k].first.second ? std::to_string(hot[k].first.second) : "?");
+        s << std::left << std::setw(24) << where << std::right
+            << std::setw(12) << f.runs << std::setw(12) << f.cycles << std::setw(8) << percent(f.cycles, all.cycles)
+            << std::setw(10) << f.dataStall << std::setw(10) << f.cacheStall << std::setw(10) << f.branchStall << std::endl;
+    }
+}
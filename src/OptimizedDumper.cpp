@@ -1,6 +1,9 @@
 #include "OptimizedDumper.h"
 
 #include <iostream>
+#include <sstream>
+#include <iterator>
+#include <cstdlib>
 #include <functional>
 #include <regex>
 
@@ -17,6 +20,14 @@ void OptimizedDumper::operator()(Program &local, const ASTNode &node) {
     for(const auto &c : local.varList.variables) {
         ss << c.getLabel() << ": .space " << c.spaceAligned() << std::endl;
     }
+    // two words per block: executions and fall-throughs of its branch
+    if(profileGenerate) {
+        for(const Function &f : local.functions)
+            ss << "__prof_cnt_" << f.identifier << ": .space " << 8 * info[&f].codes.size() << std::endl;
+        ss << "__prof_head: .asciiz \"# profile\"" << std::endl;
+        for(const Function &f : local.functions)
+            ss << "__prof_name_" << f.identifier << ": .asciiz \"@ " << f.identifier << "\"" << std::endl;
+    }
     for(const auto &item : local.strList.strings) {
         ss << item.first << ": .asciiz \"" << escapeSlash(item.second->getLiteral()) << "\"" << std::endl;
     }
@@ -25,6 +36,18 @@ void OptimizedDumper::operator()(Program &local, const ASTNode &node) {
     ss << ".text" << std::endl;
     ss << std::endl;
 
+    if(delaySlots) {
+        size_t slots = 0, filled = 0;
+        for(const Function &f : local.functions) {
+            slots += stats[&f]["delay.slots"];
+            filled += stats[&f]["delay.filled"];
+        }
+        ss << ".set noreorder" << std::endl;
+        ss << "# delay slots filled: " << filled << " of " << slots
+            << " (" << (slots ? filled * 100 / slots : 100) << "%)" << std::endl;
+        ss << std::endl;
+    }
+
     // ss << "j " << local.functions[local.functions.size() - 1].entryLabel() << std::endl;
     ss << ".globl " << local.functions[local.functions.size() - 1].entryLabel() << std::endl;
     ss << std::endl;
@@ -37,6 +60,36 @@ void OptimizedDumper::operator()(Program &local, const ASTNode &node) {
     }
 }
 
+bool OptimizedDumper::loadProfile(std::istream &s) {
+    std::string text((std::istreambuf_iterator<char>(s)), std::istreambuf_iterator<char>());
+    size_t p = text.rfind("# profile");
+    if(p == std::string::npos)
+        return false;
+    std::istringstream in(text.substr(p + 9));
+    auto number = [] (const std::string &t, size_t &v) {
+        char *end;
+        long long x = strtoll(t.c_str(), &end, 10);
+        v = (size_t)x;
+        return !t.empty() && !*end && x >= 0;
+    };
+    std::vector<std::pair<size_t, size_t>> *counts = nullptr;
+    std::string t, u;
+    while(in >> t) {
+        if(t == "@") {
+            if(!(in >> u))
+                return false;
+            counts = &profile[u];
+            counts->clear();
+            continue;
+        }
+        size_t count, taken;
+        if(!counts || !(in >> u) || !number(t, count) || !number(u, taken) || taken > count)
+            return false;
+        counts->emplace_back(count, taken);
+    }
+    return true;
+}
+
 struct _code_ {
     std::string s;
     _code_(): s() {}
@@ -57,7 +110,7 @@ template<>
 void OptimizedDumper::operator()(Function &local, const ASTNode &node) {
     assert(node.is("Compound"));
 
-    toMC(local, node, info[&local].codes, info[&local].labels);
+    toMC(local, node, info[&local].codes, info[&local].labels, *this);
     optimizeMC(local, info[&local].codes, info[&local].labels, *this);
     optToMIPS(local, *this);
 
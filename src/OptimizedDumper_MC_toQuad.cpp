@@ -27,6 +27,9 @@ void MC::toQuad(std::ostream &stream, const std::string &indent, const Function
     case odiv:
         stream << indent << dst << " = " << a << " / " << b << std::endl;
         break;
+    case omod:
+        stream << indent << dst << " = " << a << " % " << b << std::endl;
+        break;
     case oloadarr:
         stream << indent << b << " = " << lab << "[" << a << "]" << std::endl;
         break;
@@ -50,6 +50,86 @@ static void optJump(std::vector<std::vector<MC>> &codes, const std::vector<std::
     }
 }
 
+std::string mcDef(const MC &c) {
+    switch(c.o) {
+    case oli:
+    case oneg:
+    case omov:
+    case omovv0:
+    case oadd:
+    case osub:
+    case omul:
+    case odiv:
+    case omod:
+    case orint:
+    case orchar:
+        return c.dst;
+    case oloadarr:
+        return c.b;
+    default:
+        break;
+    }
+    return "";
+}
+
+std::vector<std::string> mcUses(const MC &c) {
+    std::vector<std::string> u;
+    auto add = [&] (const std::string &id) {
+        if(!id.empty() && id[0] != '-' && !isdigit(id[0]))
+            u.push_back(id);
+    };
+    switch(c.o) {
+    case oneg:
+    case omov:
+    case oarg:
+    case obeqz:
+    case obnez:
+    case oloadarr:
+        add(c.a);
+        break;
+    case oadd:
+    case osub:
+    case omul:
+    case odiv:
+    case omod:
+    case ostorearr:
+    case obeq:
+    case obne:
+    case oblt:
+    case oble:
+    case obgt:
+    case obge:
+        add(c.a);
+        add(c.b);
+        break;
+    case oret:
+    case opint:
+    case opchar:
+        add(c.dst);
+        break;
+    default:
+        break;
+    }
+    return u;
+}
+
+void optRemoveBlocks(std::vector<std::vector<MC>> &codes, std::vector<std::string> &labels,
+        const std::vector<bool> &keep) {
+    assert(codes.size() == labels.size() && keep.size() == codes.size());
+    size_t n = 0;
+    for(size_t i = 0; i < codes.size(); ++i) {
+        if(!keep[i])
+            continue;
+        if(n != i) {
+            codes[n].swap(codes[i]);
+            labels[n].swap(labels[i]);
+        }
+        ++n;
+    }
+    codes.resize(n);
+    labels.resize(n);
+}
+
 std::vector<std::vector<size_t>> optCalcNxt(const std::vector<std::vector<MC>> &entities,
         const std::vector<std::string> &labels) {
     const std::set<OP> branchOps {
@@ -78,13 +158,45 @@ std::vector<std::vector<size_t>> optCalcNxt(const std::vector<std::vector<MC>> &
     return nxt;
 }
 
+static void keepStage(const Function &local, const std::string &stage,
+        const std::vector<std::vector<MC>> &codes, const std::vector<std::string> &labels,
+        OptimizedDumper &dumper) {
+    if(!dumper.keepStages)
+        return;
+    auto iter = dumper.stages.begin();
+    while(iter != dumper.stages.end() && iter->first != stage)
+        ++iter;
+    if(iter == dumper.stages.end())
+        iter = dumper.stages.insert(iter, {stage, {}});
+    iter->second[&local] = OptimizedDumper::codeInfo{codes, labels};
+}
+
 void optimizeMC(Function &local, std::vector<std::vector<MC>> &codes,
-        const std::vector<std::string> &labels, OptimizedDumper &dumper) {
+        std::vector<std::string> &labels, OptimizedDumper &dumper) {
     #ifdef DEBUG
     std::cerr << "Optimizing function " << local.identifier << std::endl;
     #endif
 
+    keepStage(local, "tomc", codes, labels, dumper);
+
+    optTailRecursion(local, codes, labels, dumper);
+
+    optSCCP(local, codes, labels, dumper);
+
     optJump(codes, labels);
+    keepStage(local, "jump", codes, labels, dumper);
+
+    optGVN(local, codes, labels, dumper);
+    keepStage(local, "gvn", codes, labels, dumper);
+
+    optCopyProp(local, codes, labels, dumper);
+    keepStage(local, "copy", codes, labels, dumper);
+
+    optDCE(local, codes, labels, dumper);
+    keepStage(local, "dce", codes, labels, dumper);
+
+    optCleanCFG(local, codes, labels, dumper);
+    keepStage(local, "cfg", codes, labels, dumper);
 
     std::vector<std::vector<MC>> entities;
     std::vector<std::map<std::string, size_t>> ieMap;
@@ -110,8 +222,20 @@ void optimizeMC(Function &local, std::vector<std::vector<MC>> &codes,
     std::vector<std::set<std::string>> restore;
 
     optRestore(local, labels, entities, ieMap, usage, cover, restore);
+    keepStage(local, "dag", entities, labels, dumper);
 
     optAssignReg(local, entities, labels, usage, dumper);
+    keepStage(local, "reg", entities, labels, dumper);
+
+    optCoalesce(local, entities, labels, dumper);
+    keepStage(local, "coalesce", entities, labels, dumper);
+
+    // the counters of an instrumented build are numbered as the blocks
+    // come in here, which a profile handed back later relies on
+    if(!dumper.profileGenerate) {
+        optLayout(local, entities, labels, dumper);
+        keepStage(local, "layout", entities, labels, dumper);
+    }
 
     dumper.info[&local].codes = entities;
 }
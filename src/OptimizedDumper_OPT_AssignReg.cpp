@@ -1,6 +1,7 @@
 #include "OptimizedDumper.h"
 
 #include <cmath>
+#include <limits>
 #include <set>
 #include <map>
 
@@ -93,9 +94,8 @@ void optAssignReg(Function &local,
     };
 
     if(polluteAReg) {
-        if(!entities[0].empty())
-        for(size_t i = 0; i < 4 && i < paramList.size(); ++i) {
-            std::string param = paramList[i].identifier, reg = std::string("$a") + std::to_string(i);
+        for(size_t i = 0; i < mipsArgRegs.size() && i < paramList.size(); ++i) {
+            std::string param = paramList[i].identifier, reg = mipsArgRegs[i];
 
             if(pollutedBlock(entities[0])) {
                 if(usedAfter(0, param)) {
@@ -109,7 +109,7 @@ void optAssignReg(Function &local,
             replaceToReg(0, 1, param, reg);
 
             if(usedAfter(1, param)) {
-                if(endOps.find(entities[0].back().o) == endOps.end()) {
+                if(entities[0].empty() || endOps.find(entities[0].back().o) == endOps.end()) {
                     entities[0].insert(entities[0].end(), MC{
                         omov, "", param, reg, ""
                     });
@@ -121,8 +121,8 @@ void optAssignReg(Function &local,
             }
         }
     } else {
-        for(size_t i = 0; i < 4 && i < paramList.size(); ++i) {
-            std::string param = paramList[i].identifier, reg = std::string("$a") + std::to_string(i);
+        for(size_t i = 0; i < mipsArgRegs.size() && i < paramList.size(); ++i) {
+            std::string param = paramList[i].identifier, reg = mipsArgRegs[i];
             replaceToReg(0, entities.size(), param, reg);
         }
     }
@@ -147,7 +147,7 @@ void optAssignReg(Function &local,
         if(!entities[i].empty() && entities[i].front().o == omovv0) {
             t = entities[i].front().dst;
             entities[i].front() = MC{
-                omov, "", t, "$v0", ""
+                omov, "", t, "$v0", "", entities[i].front().line
             };
             if(t[0] == '#')
                 replaceToReg(i, i + 1, t, "$v0");
@@ -175,11 +175,19 @@ void optAssignReg(Function &local,
     std::vector<double> logTimes;
     logTimes.resize(entities.size());
 
-    for(size_t i = 0; i < entities.size(); ++i)
-    for(size_t j : nxt[i])
-    if(j <= i)
-    for(size_t k = j; k <= i; ++k)
-        ++logTimes[k];
+    // a profile gives the real counts, otherwise each loop around a block
+    // counts as 3.5 times
+    auto profile = dumper.profile.find(local.identifier);
+    if(profile != dumper.profile.end() && profile->second.size() == entities.size()) {
+        for(size_t i = 0; i < entities.size(); ++i)
+            logTimes[i] = log((double)profile->second[i].first + 1.0) / log(3.5);
+    } else {
+        for(size_t i = 0; i < entities.size(); ++i)
+        for(size_t j : nxt[i])
+        if(j <= i)
+        for(size_t k = j; k <= i; ++k)
+            ++logTimes[k];
+    }
 
     auto notGlobal = [&] (const std::string &id) {
         auto t = local.lookup(id).type;
@@ -187,7 +195,7 @@ void optAssignReg(Function &local,
     };
     auto inStackFirst = [&] (const std::string &var) {
         auto iter = local.paramList.lookup.find(var);
-        return iter != local.paramList.lookup.end() && iter->second >= 4;
+        return iter != local.paramList.lookup.end() && iter->second >= mipsArgRegs.size();
     };
 
     for(size_t i = 0; i < entities.size(); ++i) {
@@ -212,11 +220,70 @@ void optAssignReg(Function &local,
         "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
         "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7", "$t8"
     };
+    // the temporaries arguments travel in are never handed out
+    for(const auto &reg : mipsArgRegs)
+        leftRegs.erase(reg);
     auto &protectRegs = dumper.protectRegs[&local];
 
+    // variables take the registers no callee writes first, those survive
+    // calls without being saved and reloaded
+    std::set<std::string> calleeClobbers;
+    for(const auto &block : entities)
+    for(const auto &code : block)
+    if(code.o == ocall && code.lab != local.identifier) {
+        auto iter = dumper.clobbers.find(local.lookup(code.lab).result.f);
+        if(iter == dumper.clobbers.end())
+            calleeClobbers.insert(leftRegs.begin(), leftRegs.end());
+        else
+            calleeClobbers.insert(iter->second.begin(), iter->second.end());
+    }
+    std::vector<std::string> varRegs;
+    for(const auto &reg : leftRegs)
+    if(calleeClobbers.find(reg) == calleeClobbers.end())
+        varRegs.push_back(reg);
+    for(size_t i = 0; i < 8; ++i)
+    if(calleeClobbers.find("$s" + std::to_string(i)) != calleeClobbers.end())
+        varRegs.push_back("$s" + std::to_string(i));
+
+    // of the variables getting a register, those live across the most calls
+    // take the ones no callee writes, the others get saved around them
+    std::map<std::string, double> crossings;
+    {
+        size_t n = entities.size();
+        std::vector<std::set<std::string>> in(n);
+        bool changed = true;
+        while(changed) {
+            changed = false;
+            for(size_t i = n - 1; i < n; --i) {
+                std::set<std::string> live;
+                for(size_t j : nxt[i])
+                    live.insert(in[j].begin(), in[j].end());
+                for(auto iter = entities[i].rbegin(); iter != entities[i].rend(); ++iter) {
+                    live.erase(mcDef(*iter));
+                    for(const auto &id : mcUses(*iter))
+                    if(isId(id))
+                        live.insert(id);
+                }
+                if(live != in[i]) {
+                    in[i].swap(live);
+                    changed = true;
+                }
+            }
+        }
+        for(size_t i = 0; i < n; ++i)
+        if(!entities[i].empty() && entities[i].back().o == ocall)
+        for(size_t j : nxt[i])
+        for(const auto &id : in[j])
+            crossings[id] += pow(3.5, logTimes[i]);
+    }
+    std::stable_sort(sortedLocals.begin(), sortedLocals.begin() + std::min<size_t>(8, sortedLocals.size()),
+        [&] (const std::string &a, const std::string &b) {
+            return crossings[a] > crossings[b];
+        });
+
     for(size_t i = 0; i < 8 && i < sortedLocals.size(); ++i) {
         auto var = sortedLocals[i];
-        std::string reg = std::string("$s") + std::to_string(i);
+        std::string reg = varRegs[i];
         leftRegs.erase(reg);
         protectRegs[reg] = var;
         if(inStackFirst(var)) {
@@ -295,7 +362,7 @@ void optAssignReg(Function &local,
 
     const std::set<OP> geneDstOps {
         oli, oneg, omov, omovv0,
-        oadd, osub, omul, odiv
+        oadd, osub, omul, odiv, omod
     };
 
     auto lastUsage = [&] (const std::vector<MC> &block, const std::string &t) {
@@ -352,7 +419,7 @@ void optAssignReg(Function &local,
             auto scape = assignedTo[reg];
             assignedWith[scape] = newTmpVar();
             toAdd[i].push_back(MC{
-                omov, "", assignedWith[scape], reg, ""
+                omov, "", assignedWith[scape], reg, "", block[i].line
             });
             assignedTo[reg] = c;
             assignedWith[c] = reg;
@@ -374,7 +441,7 @@ void optAssignReg(Function &local,
                     reassignTmpRegs(c);
                 }
                 toAdd[i].push_back(MC{
-                    omov, "", assignedWith[c], oldAss, ""
+                    omov, "", assignedWith[c], oldAss, "", block[i].line
                 });
             }
         };
@@ -525,9 +592,9 @@ void optAssignReg(Function &local,
                 assert(code.a[0] == '$');
                 size_t a;
                 sscanf(code.dst.c_str(), "%zu", &a);
-                if(a < 4) {
+                if(a < mipsArgRegs.size()) {
                     code = MC{
-                        omov, "", std::string("$a") + code.dst, code.a, ""
+                        omov, "", mipsArgRegs[a], code.a, "", code.line
                     };
                 }
             }
@@ -539,13 +606,13 @@ void optAssignReg(Function &local,
         oret, opint, opchar
     }, useAOps {
         omov, oneg,
-        oadd, osub, omul, odiv,
+        oadd, osub, omul, odiv, omod,
         oloadarr, ostorearr,
         obeqz, obnez,
         obeq, obne, oblt, oble, obgt, obge,
         oarg
     }, useBOps {
-        oadd, osub, omul, odiv,
+        oadd, osub, omul, odiv, omod,
         ostorearr,
         obeq, obne, oblt, oble, obgt, obge
     };
@@ -593,6 +660,18 @@ void optAssignReg(Function &local,
             opt |= regProtection(i);
     }
 
+    // what a call may change is summarised when optToMIPS has the callee's
+    // code, and callees come first in the source; a function has no
+    // summary while it is compiled, so a call to itself keeps nothing
+    auto clobbered = [&] (const std::string &callee, const std::string &reg) {
+        auto iter = dumper.clobbers.find(local.lookup(callee).result.f);
+        return iter == dumper.clobbers.end() || iter->second.find(reg) != iter->second.end();
+    };
+
+    // the call ends its block, so what has to survive it is exactly what
+    // the successors read before writing; registers only read on the way
+    // to the call are left to the callee
+    auto &stats = dumper.stats[&local];
     std::vector<std::vector<std::string>> blockProtectRegs;
     blockProtectRegs.resize(entities.size());
     for(size_t i = 0; i < entities.size(); ++i) {
@@ -602,10 +681,35 @@ void optAssignReg(Function &local,
         auto &code = block.back();
         if(code.o != ocall)
             continue;
+        std::set<std::string> after;
+        for(size_t j : nxt[i])
+        for(const auto &reg : restore[j])
+        if(cover[j].find(reg) == cover[j].end())
+            after.insert(reg);
         for(const auto &item : protectRegs) {
-            if(restore[i].find(item.first) != restore[i].end())
-                blockProtectRegs[i].push_back(item.first);
+            if(after.find(item.first) == after.end()) {
+                if(restore[i].find(item.first) != restore[i].end())
+                    ++stats["save.dead"];
+                continue;
+            }
+            if(!clobbered(code.lab, item.first)) {
+                #ifdef DEBUG
+                std::cerr << "Kept " << item.first << " across the call to " << code.lab << std::endl;
+                #endif
+                ++stats["clobber.kept"];
+                continue;
+            }
+            blockProtectRegs[i].push_back(item.first);
         }
+        // one store before and one load after the call per register
+        size_t n = blockProtectRegs[i].size();
+        #ifdef DEBUG
+        std::cerr << "Call to " << code.lab << " in block " << i << " saves " << n
+            << " of " << after.size() << " live registers" << std::endl;
+        #endif
+        stats["save.b" + std::to_string(i) + "." + code.lab] = n;
+        stats["save.stores"] += n;
+        stats["save.loads"] += n;
     }
 
     auto protectOnCall = [&] (size_t i) {
@@ -614,13 +718,13 @@ void optAssignReg(Function &local,
         std::vector<MC> nc(entities[i].begin(), entities[i].end() - 1);
         for(const auto &reg : blockProtectRegs[i]) {
             nc.emplace_back(MC{
-                omov, "", protectRegs[reg], reg, ""
+                omov, "", protectRegs[reg], reg, "", entities[i].back().line
             });
         }
         nc.push_back(entities[i].back());
         for(const auto &reg : blockProtectRegs[i]) {
             nc.emplace_back(MC{
-                omov, "", reg, protectRegs[reg], ""
+                omov, "", reg, protectRegs[reg], "", entities[i].back().line
             });
         }
         return nc;
@@ -674,8 +778,12 @@ void optAssignReg(Function &local,
         return res.type == TLocalVariable || res.type == TParameter;
     };
 
-    auto &hasStInter = dumper.hasStInter[&local];
-    hasStInter = false;
+    auto &frameVars = dumper.frameVars[&local];
+    frameVars.clear();
+    auto inFrame = [&] (const std::string &id) {
+        if(isVar(id) && isLocal(id))
+            frameVars.insert(id);
+    };
     for(size_t i = 0; i < entities.size(); ++i) {
         const auto &block = entities[i];
         for(const auto &code: block) {
@@ -697,8 +805,8 @@ void optAssignReg(Function &local,
                 assert(code.dst[0] == '$' || isVar(code.dst));
                 assert(code.a[0] == '$' || isVar(code.a));
                 assert(!(isVar(code.dst) && isVar(code.a)));
-                if((isVar(code.dst) && isLocal(code.dst)) || (isVar(code.a) && isLocal(code.a)))
-                    hasStInter = true;
+                inFrame(code.dst);
+                inFrame(code.a);
                 assert(code.b.empty());
                 break;
             case oarg:
@@ -716,6 +824,7 @@ void optAssignReg(Function &local,
             case osub:
             case omul:
             case odiv:
+            case omod:
                 assert(code.lab.empty());
                 assert(code.dst[0] == '$');
                 assert(code.a[0] == '$');
@@ -726,8 +835,10 @@ void optAssignReg(Function &local,
             case ostorearr:
                 assert(isArr(code.lab));
                 assert(code.dst.empty());
-                assert(code.a[0] == '$');
+                assert(code.a[0] == '$' || isdigit(code.a[0]) || code.a[0] == '-');
                 assert(code.b[0] == '$');
+                if(isLocal(code.lab))
+                    frameVars.insert(code.lab);
                 break;
             case ojmp:
                 assert(!code.lab.empty());
@@ -763,6 +874,8 @@ void optAssignReg(Function &local,
                 assert(code.lab.empty());
                 assert(code.dst.empty() || code.dst[0] == '$' || isVar(code.dst)
                     || isdigit(code.dst[0]) || code.dst[0] == '-');
+                if(!code.dst.empty())
+                    inFrame(code.dst);
                 assert(code.a.empty());
                 assert(code.b.empty());
                 break;
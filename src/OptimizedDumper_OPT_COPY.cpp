@@ -0,0 +1,275 @@
+#include "OptimizedDumper.h"
+
+#include <set>
+#include <map>
+
+static bool isId(const std::string &id) {
+    return !id.empty() && id[0] != '#' && id[0] != '-' && !isdigit(id[0]) && id[0] != '$';
+}
+
+static bool isReg(const std::string &id) {
+    return !id.empty() && id[0] == '$';
+}
+
+void optCopyProp(const Function &local, std::vector<std::vector<MC>> &codes,
+        const std::vector<std::string> &labels, OptimizedDumper &dumper) {
+    typedef std::map<std::string, std::string> Copies;
+
+    auto &stats = dumper.stats[&local];
+
+    auto tracked = [&] (const std::string &id) {
+        return isId(id) && local.lookup(id).type != TGlobalVariable;
+    };
+    // an int may not be renamed to a char nor the other way around,
+    // temporaries take whatever they are assigned
+    auto typeOf = [&] (const std::string &id) {
+        auto res = local.lookup(id);
+        if(res.type == TLocalVariable || res.type == TParameter)
+            return res.result.v->type == VarCharType ? 'c' : 'i';
+        return '?';
+    };
+    auto compatible = [&] (const std::string &a, const std::string &b) {
+        char ta = typeOf(a), tb = typeOf(b);
+        return ta == '?' || tb == '?' || ta == tb;
+    };
+
+    auto substitute = [&] (const Copies &cp, MC &c) {
+        size_t cnt = 0;
+        auto rep = [&] (std::string &id) {
+            auto iter = cp.find(id);
+            if(iter == cp.end())
+                return;
+            id = iter->second;
+            ++cnt;
+        };
+        switch(c.o) {
+        case oneg:
+        case omov:
+        case oarg:
+        case obeqz:
+        case obnez:
+        case oloadarr:
+            rep(c.a);
+            break;
+        case oadd:
+        case osub:
+        case omul:
+        case odiv:
+        case omod:
+        case ostorearr:
+        case obeq:
+        case obne:
+        case oblt:
+        case oble:
+        case obgt:
+        case obge:
+            rep(c.a);
+            rep(c.b);
+            break;
+        case oret:
+        case opint:
+        case opchar:
+            rep(c.dst);
+            break;
+        default:
+            break;
+        }
+        return cnt;
+    };
+
+    auto transfer = [&] (Copies &cp, const MC &c) {
+        auto d = mcDef(c);
+        if(d.empty())
+            return;
+        for(auto iter = cp.begin(); iter != cp.end(); ) {
+            if(iter->first == d || iter->second == d)
+                iter = cp.erase(iter);
+            else
+                ++iter;
+        }
+        if(c.o == omov && tracked(c.dst) && tracked(c.a) && c.dst != c.a && compatible(c.dst, c.a))
+            cp[c.dst] = c.a;
+    };
+
+    size_t n = codes.size();
+    std::vector<std::vector<size_t>> nxt = optCalcNxt(codes, labels);
+    std::vector<std::vector<size_t>> pre(n);
+    for(size_t i = 0; i < n; ++i)
+    for(size_t j : nxt[i])
+        pre[j].push_back(i);
+
+    // available copies, intersected over all predecessors
+    std::vector<Copies> in(n), out(n);
+    std::vector<bool> visited(n, false);
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(size_t i = 0; i < n; ++i) {
+            Copies cp;
+            if(i != 0) {
+                bool first = true;
+                for(size_t p : pre[i]) {
+                    if(!visited[p])
+                        continue;
+                    if(first) {
+                        cp = out[p];
+                        first = false;
+                        continue;
+                    }
+                    for(auto iter = cp.begin(); iter != cp.end(); ) {
+                        auto jter = out[p].find(iter->first);
+                        if(jter == out[p].end() || jter->second != iter->second)
+                            iter = cp.erase(iter);
+                        else
+                            ++iter;
+                    }
+                }
+            }
+            // a temporary read in another block would need a home of its own
+            for(auto iter = cp.begin(); iter != cp.end(); ) {
+                if(iter->second.substr(0, 8) == "tempVar$")
+                    iter = cp.erase(iter);
+                else
+                    ++iter;
+            }
+            in[i] = cp;
+            for(auto c : codes[i]) {
+                substitute(cp, c);
+                transfer(cp, c);
+            }
+            if(!visited[i] || cp != out[i]) {
+                visited[i] = true;
+                out[i].swap(cp);
+                changed = true;
+            }
+        }
+    }
+
+    for(size_t i = 0; i < n; ++i) {
+        Copies cp = in[i];
+        for(auto &c : codes[i]) {
+            size_t cnt = substitute(cp, c);
+            #ifdef DEBUG
+            if(cnt)
+                std::cerr << "Propagated copies into block " << i << ": " << cnt << std::endl;
+            #endif
+            stats["copy.propagated"] += cnt;
+            transfer(cp, c);
+        }
+    }
+}
+
+void optCoalesce(const Function &local, std::vector<std::vector<MC>> &entities,
+        const std::vector<std::string> &labels, OptimizedDumper &dumper) {
+    const std::set<OP> geneDstOps {
+        oli, oneg, omov,
+        oadd, osub, omul, odiv, omod
+    }, calcOps {
+        oli, oneg, omov,
+        oadd, osub, omul, odiv, omod,
+        oloadarr, ostorearr
+    };
+
+    auto &stats = dumper.stats[&local];
+
+    auto regDef = [&] (const MC &c) -> std::string {
+        if(c.o == oloadarr)
+            return c.b;
+        if(geneDstOps.find(c.o) != geneDstOps.end())
+            return c.dst;
+        return "";
+    };
+    auto regUses = [&] (const MC &c) {
+        std::vector<std::string> u;
+        for(const auto &id : mcUses(c))
+        if(isReg(id))
+            u.push_back(id);
+        if(c.o == ocall)
+            u.insert(u.end(), mipsArgRegs.begin(), mipsArgRegs.end());
+        return u;
+    };
+    auto uses = [&] (const MC &c, const std::string &r) {
+        for(const auto &id : regUses(c))
+        if(id == r)
+            return true;
+        return false;
+    };
+
+    size_t n = entities.size();
+    std::vector<std::vector<size_t>> nxt = optCalcNxt(entities, labels);
+    std::vector<std::set<std::string>> in(n), out(n);
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(size_t i = n - 1; i < n; --i) {
+            std::set<std::string> live;
+            for(size_t j : nxt[i])
+                live.insert(in[j].begin(), in[j].end());
+            out[i] = live;
+            for(auto iter = entities[i].rbegin(); iter != entities[i].rend(); ++iter) {
+                live.erase(regDef(*iter));
+                for(const auto &id : regUses(*iter))
+                    live.insert(id);
+            }
+            if(live != in[i]) {
+                in[i].swap(live);
+                changed = true;
+            }
+        }
+    }
+
+    auto deadAfter = [&] (size_t i, size_t q, const std::string &r) {
+        const auto &block = entities[i];
+        for(size_t k = q + 1; k < block.size(); ++k) {
+            if(uses(block[k], r))
+                return false;
+            if(regDef(block[k]) == r)
+                return true;
+        }
+        return out[i].find(r) == out[i].end();
+    };
+
+    for(size_t i = 0; i < n; ++i) {
+        auto &block = entities[i];
+        std::vector<bool> drop(block.size(), false);
+        for(size_t q = 0; q < block.size(); ++q) {
+            const MC &m = block[q];
+            if(m.o != omov || !isReg(m.dst) || !isReg(m.a) || m.dst == m.a)
+                continue;
+            const std::string d = m.dst, s = m.a;
+            // the instruction computing s must be reachable without
+            // passing anything that reads or writes d
+            size_t p = q - 1;
+            bool ok = false;
+            for(; p < q; --p) {
+                if(drop[p])
+                    continue;
+                const MC &c = block[p];
+                if(calcOps.find(c.o) == calcOps.end())
+                    break;
+                if(regDef(c) == s) {
+                    ok = true;
+                    break;
+                }
+                if(uses(c, s) || uses(c, d) || regDef(c) == d)
+                    break;
+            }
+            if(!ok || !deadAfter(i, q, s))
+                continue;
+            #ifdef DEBUG
+            std::cerr << "Coalesced " << s << " into " << d << " in block " << i << std::endl;
+            #endif
+            if(block[p].o == oloadarr)
+                block[p].b = d;
+            else
+                block[p].dst = d;
+            drop[q] = true;
+            ++stats["coalesce.moves"];
+        }
+        std::vector<MC> nc;
+        for(size_t k = 0; k < block.size(); ++k)
+        if(!drop[k] && !(block[k].o == omov && block[k].dst == block[k].a))
+            nc.push_back(block[k]);
+        block.swap(nc);
+    }
+}
@@ -12,7 +12,7 @@ void optDAG(const Function &local, std::vector<MC> &codes,
         std::set<std::string> &usage, std::set<std::string> &cover) {
     const std::set<OP> calcOps {
         oli, oneg, omov, oarg,
-        oadd, osub, omul, odiv,
+        oadd, osub, omul, odiv, omod,
         oloadarr, ostorearr
     }, endOps {
         ojmp, obeq, obne, oblt, oble, obgt, obge,
@@ -43,13 +43,15 @@ void optDAG(const Function &local, std::vector<MC> &codes,
     };
 
     std::map<std::string, size_t> revE;
+    // a value is loaded for the statement first reading it
+    size_t line = 0;
 
     auto use = [&] (const std::string &id) {
         assert(isId(id));
         if(ie.find(id) == ie.end()) {
             auto neid = entities.size();
             entities.emplace_back(MC{
-                omov, "", toLabel(neid), id, ""
+                omov, "", toLabel(neid), id, "", line
             });
             usage.insert(id);
             ie[id] = neid;
@@ -59,6 +61,7 @@ void optDAG(const Function &local, std::vector<MC> &codes,
 
     for(size_t i = 0; i < codes.size(); ++i) {
         const MC &c = codes[i];
+        line = c.line;
         switch(c.o) {
         case omovv0: {
             auto eid = entities.size();
@@ -136,7 +139,8 @@ void optDAG(const Function &local, std::vector<MC> &codes,
             break;
         }
         case oloadarr: {
-            use(c.a);
+            if(isId(c.a))
+                use(c.a);
 
             auto eid = entities.size();
             entities.push_back(c);
@@ -145,14 +149,16 @@ void optDAG(const Function &local, std::vector<MC> &codes,
             ie[c.b] = eid;
 
             MC cc = c;
-            cc.a = toLabel(ie[c.a]);
+            if(isId(c.a))
+                cc.a = toLabel(ie[c.a]);
             cc.b = toLabel(eid);
             entities[eid] = cc;
             break;
         }
         case ostorearr: {
             MC cc = c;
-            cc.a = toLabel(use(c.a));
+            if(isId(c.a))
+                cc.a = toLabel(use(c.a));
             cc.b = toLabel(use(c.b));
             entities.push_back(cc);
             break;
@@ -176,7 +182,7 @@ void optDAG(const Function &local, std::vector<MC> &codes,
                 break;
             }
 
-            if(ca.b[0] == '#') {
+            if(c.o != osub && ca.b[0] == '#') {
                 MC cb = ca;
                 std::swap(cb.a, cb.b);
                 if(revE.find(toCSeq(cb)) != revE.end()) {
@@ -190,8 +196,44 @@ void optDAG(const Function &local, std::vector<MC> &codes,
                 }
             }
 
+            // a - a / m * m is what the remainder of a / m looks like without %
+            if(c.o == osub && ca.b[0] == '#') {
+                const MC &cm = entities[std::stoul(ca.b.substr(1))];
+                std::string m;
+                for(size_t k = 0; k < 2 && cm.o == omul && m.empty(); ++k) {
+                    const std::string &q = k ? cm.b : cm.a, &f = k ? cm.a : cm.b;
+                    if(q.empty() || q[0] != '#')
+                        continue;
+                    const MC &cd = entities[std::stoul(q.substr(1))];
+                    if(cd.o == odiv && cd.a == ca.a && cd.b == f)
+                        m = f;
+                }
+                if(!m.empty()) {
+                    MC cr {omod, "", "", ca.a, m, c.line};
+                    #ifdef DEBUG
+                    std::cerr << "Optimized remainder: " << c.dst << " = " << c.a << " % " << m << std::endl;
+                    #endif
+                    if(revE.find(toCSeq(cr)) != revE.end()) {
+                        cover.insert(c.dst);
+                        ie[c.dst] = revE[toCSeq(cr)];
+                        break;
+                    }
+                    auto eid = entities.size();
+                    entities.push_back(c);
+
+                    cover.insert(c.dst);
+                    ie[c.dst] = eid;
+
+                    revE[toCSeq(cr)] = eid;
+
+                    cr.dst = toLabel(eid);
+                    entities[eid] = cr;
+                    break;
+                }
+            }
+
             if(c.o == osub && ca.a == ca.b && c.a != c.dst && c.b != c.dst) {
-                MC cc {oli, "", "", "0", ""};
+                MC cc {oli, "", "", "0", "", c.line};
                 if(revE.find(toCSeq(cc)) != revE.end()) {
                     #ifdef DEBUG
                     std::cerr << "Optimized same li 0: sub " << c.dst
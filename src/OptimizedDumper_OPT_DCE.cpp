@@ -0,0 +1,226 @@
+#include "OptimizedDumper.h"
+
+#include <set>
+#include <map>
+#include <deque>
+
+static bool isId(const std::string &id) {
+    return !id.empty() && id[0] != '#' && id[0] != '-' && !isdigit(id[0]) && id[0] != '$';
+}
+
+void optDCE(const Function &local, std::vector<std::vector<MC>> &codes,
+        const std::vector<std::string> &labels, OptimizedDumper &dumper) {
+    const std::set<OP> pureOps {
+        oli, oneg, omov, omovv0,
+        oadd, osub, omul, odiv, omod,
+        oloadarr
+    };
+
+    auto &stats = dumper.stats[&local];
+
+    auto tracked = [&] (const std::string &id) {
+        return isId(id) && local.lookup(id).type != TGlobalVariable;
+    };
+
+    bool opt = true;
+    while(opt) {
+        opt = false;
+
+        size_t n = codes.size();
+        std::vector<std::vector<size_t>> nxt = optCalcNxt(codes, labels);
+        std::vector<std::set<std::string>> in(n), out(n);
+
+        bool changed = true;
+        while(changed) {
+            changed = false;
+            for(size_t i = n - 1; i < n; --i) {
+                std::set<std::string> live;
+                for(size_t j : nxt[i])
+                    live.insert(in[j].begin(), in[j].end());
+                out[i] = live;
+                for(auto iter = codes[i].rbegin(); iter != codes[i].rend(); ++iter) {
+                    live.erase(mcDef(*iter));
+                    for(const auto &id : mcUses(*iter))
+                    if(tracked(id))
+                        live.insert(id);
+                }
+                if(live != in[i]) {
+                    in[i].swap(live);
+                    changed = true;
+                }
+            }
+        }
+
+        for(size_t i = 0; i < n; ++i) {
+            std::set<std::string> live = out[i];
+            std::vector<MC> nc;
+            for(auto iter = codes[i].rbegin(); iter != codes[i].rend(); ++iter) {
+                const MC &c = *iter;
+                auto d = mcDef(c);
+                if(pureOps.find(c.o) != pureOps.end() && tracked(d) && live.find(d) == live.end()) {
+                    #ifdef DEBUG
+                    std::cerr << "Removed dead definition of " << d << " in block " << i << std::endl;
+                    #endif
+                    ++stats["dce.instructions"];
+                    opt = true;
+                    continue;
+                }
+                live.erase(d);
+                for(const auto &id : mcUses(c))
+                if(tracked(id))
+                    live.insert(id);
+                nc.push_back(c);
+            }
+            codes[i].assign(nc.rbegin(), nc.rend());
+        }
+    }
+}
+
+void optCleanCFG(const Function &local, std::vector<std::vector<MC>> &codes,
+        std::vector<std::string> &labels, OptimizedDumper &dumper) {
+    const std::set<OP> branchOps {
+        ojmp, obeq, obne, oblt, oble, obgt, obge, obeqz, obnez
+    }, endOps {
+        ojmp, obeq, obne, oblt, oble, obgt, obge,
+        obeqz, obnez,
+        ocall, oret,
+        opstr, opint, opchar,
+        orint, orchar
+    };
+
+    auto &stats = dumper.stats[&local];
+
+    // main returns by jumping to its (empty) end block, which must stay last
+    bool isMain = local.node.is("MainFunc");
+    auto pinned = [&] (size_t i) {
+        return i == 0 || (isMain && i + 1 == codes.size());
+    };
+
+    auto targets = [&] () {
+        std::map<std::string, size_t> refs;
+        for(const auto &block : codes)
+        if(!block.empty() && branchOps.find(block.back().o) != branchOps.end())
+            ++refs[block.back().lab];
+        return refs;
+    };
+
+    auto removeBlock = [&] (size_t i) {
+        #ifdef DEBUG
+        std::cerr << "Removed block " << i;
+        if(!labels[i].empty())
+            std::cerr << " (" << labels[i] << ")";
+        std::cerr << std::endl;
+        #endif
+        std::vector<bool> keep(codes.size(), true);
+        keep[i] = false;
+        optRemoveBlocks(codes, labels, keep);
+        ++stats["cfg.blocks"];
+    };
+
+    bool opt = true;
+    while(opt) {
+        opt = false;
+
+        // jumps to the block right behind
+        for(size_t i = 0; i + 1 < codes.size(); ++i) {
+            if(codes[i].empty() || codes[i].back().o != ojmp)
+                continue;
+            if(codes[i].back().lab != labels[i + 1])
+                continue;
+            #ifdef DEBUG
+            std::cerr << "Removed jump to next block " << labels[i + 1] << " in block " << i << std::endl;
+            #endif
+            codes[i].pop_back();
+            ++stats["cfg.jumps"];
+            opt = true;
+        }
+
+        // unreachable blocks
+        std::map<std::string, size_t> revLabels;
+        for(size_t i = 0; i < labels.size(); ++i)
+        if(!labels[i].empty())
+            revLabels[labels[i]] = i;
+        std::vector<bool> reached(codes.size(), false);
+        std::deque<size_t> q {0};
+        reached[0] = true;
+        while(!q.empty()) {
+            size_t i = q.front();
+            q.pop_front();
+            std::vector<size_t> s;
+            bool fall = true;
+            if(!codes[i].empty()) {
+                const MC &c = codes[i].back();
+                if(branchOps.find(c.o) != branchOps.end())
+                    s.push_back(revLabels[c.lab]);
+                fall = c.o != ojmp && c.o != oret;
+            }
+            if(fall && i + 1 < codes.size())
+                s.push_back(i + 1);
+            for(size_t j : s)
+            if(!reached[j]) {
+                reached[j] = true;
+                q.push_back(j);
+            }
+        }
+        std::vector<bool> keep(reached);
+        for(size_t i = 0; i < codes.size(); ++i) {
+            if(pinned(i))
+                keep[i] = true;
+            if(!keep[i]) {
+                #ifdef DEBUG
+                std::cerr << "Removed unreachable block " << i << std::endl;
+                #endif
+                ++stats["cfg.blocks"];
+                opt = true;
+            }
+        }
+        optRemoveBlocks(codes, labels, keep);
+
+        // empty blocks hand their label over to the next block
+        auto refs = targets();
+        for(size_t i = 1; i + 1 < codes.size(); ++i) {
+            if(!codes[i].empty() || pinned(i))
+                continue;
+            const std::string &l = labels[i];
+            if(!l.empty() && refs[l]) {
+                if(labels[i + 1].empty()) {
+                    labels[i + 1] = l;
+                } else {
+                    for(auto &block : codes)
+                    if(!block.empty() && branchOps.find(block.back().o) != branchOps.end()
+                            && block.back().lab == l)
+                        block.back().lab = labels[i + 1];
+                }
+            }
+            removeBlock(i);
+            opt = true;
+            break;
+        }
+        if(opt)
+            continue;
+
+        // straight-line chains
+        refs = targets();
+        for(size_t i = 0; i + 1 < codes.size(); ++i) {
+            if(pinned(i + 1))
+                continue;
+            if(!codes[i].empty() && endOps.find(codes[i].back().o) != endOps.end())
+                continue;
+            if(!labels[i + 1].empty() && refs[labels[i + 1]])
+                continue;
+            if(!codes[i + 1].empty() && codes[i + 1].front().o == omovv0)
+                continue;
+            #ifdef DEBUG
+            std::cerr << "Merged block " << i + 1 << " into block " << i << std::endl;
+            #endif
+            codes[i].insert(codes[i].end(), codes[i + 1].begin(), codes[i + 1].end());
+            codes[i + 1].clear();
+            std::vector<bool> keep(codes.size(), true);
+            keep[i + 1] = false;
+            optRemoveBlocks(codes, labels, keep);
+            ++stats["cfg.merged"];
+            opt = true;
+            break;
+        }
+    }
+}
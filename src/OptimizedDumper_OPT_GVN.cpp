@@ -0,0 +1,335 @@
+#include "OptimizedDumper.h"
+
+#include <set>
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <functional>
+
+static bool isId(const std::string &id) {
+    return !id.empty() && id[0] != '#' && id[0] != '-' && !isdigit(id[0]) && id[0] != '$';
+}
+
+static bool isImm(const std::string &id) {
+    return !id.empty() && (id[0] == '-' || isdigit(id[0]));
+}
+
+std::vector<size_t> optCalcIdom(const std::vector<std::vector<size_t>> &nxt) {
+    size_t n = nxt.size();
+    std::vector<std::vector<size_t>> pre(n);
+    for(size_t i = 0; i < n; ++i)
+    for(size_t j : nxt[i])
+        pre[j].push_back(i);
+
+    std::vector<size_t> order, rpo(n, n);
+    std::vector<bool> visited(n, false);
+    std::function<void(size_t)> dfs = [&] (size_t i) {
+        visited[i] = true;
+        for(size_t j : nxt[i])
+        if(!visited[j])
+            dfs(j);
+        order.push_back(i);
+    };
+    if(n)
+        dfs(0);
+    std::reverse(order.begin(), order.end());
+    for(size_t i = 0; i < order.size(); ++i)
+        rpo[order[i]] = i;
+
+    std::vector<size_t> idom(n, n);
+    if(!n)
+        return idom;
+    idom[0] = 0;
+    auto intersect = [&] (size_t a, size_t b) {
+        while(a != b) {
+            while(rpo[a] > rpo[b])
+                a = idom[a];
+            while(rpo[b] > rpo[a])
+                b = idom[b];
+        }
+        return a;
+    };
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(size_t k = 1; k < order.size(); ++k) {
+            size_t i = order[k], d = n;
+            for(size_t p : pre[i]) {
+                if(idom[p] == n)
+                    continue;
+                d = d == n ? p : intersect(p, d);
+            }
+            if(d != idom[i]) {
+                idom[i] = d;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+void optGVN(const Function &local, std::vector<std::vector<MC>> &codes,
+        const std::vector<std::string> &labels, OptimizedDumper &dumper) {
+    auto &stats = dumper.stats[&local];
+
+    size_t n = codes.size();
+    std::vector<std::vector<size_t>> nxt = optCalcNxt(codes, labels);
+    std::vector<std::vector<size_t>> pre(n);
+    for(size_t i = 0; i < n; ++i)
+    for(size_t j : nxt[i])
+        pre[j].push_back(i);
+    std::vector<size_t> idom = optCalcIdom(nxt);
+
+    auto isIntArray = [&] (const std::string &id) {
+        auto res = local.lookup(id);
+        return (res.type == TLocalVariable || res.type == TGlobalVariable)
+            && res.result.v->type == VarIntArray;
+    };
+    auto canHold = [&] (const std::string &id) {
+        if(!isId(id))
+            return false;
+        auto res = local.lookup(id);
+        if(res.type == TGlobalVariable)
+            return false;
+        if((res.type == TLocalVariable || res.type == TParameter) && res.result.v->type == VarCharType)
+            return false;
+        return true;
+    };
+
+    // what a block may overwrite: variables, stored arrays and whether it calls
+    struct Kill {
+        std::set<std::string> vars, arrays;
+        bool call;
+    };
+    std::vector<Kill> kills(n);
+    for(size_t i = 0; i < n; ++i) {
+        kills[i].call = false;
+        for(const auto &c : codes[i]) {
+            auto d = mcDef(c);
+            if(!d.empty())
+                kills[i].vars.insert(d);
+            if(c.o == ostorearr)
+                kills[i].arrays.insert(c.lab);
+            if(c.o == ocall)
+                kills[i].call = true;
+        }
+    }
+
+    // blocks that may run between the end of idom(b) and the start of b
+    auto region = [&] (size_t b) {
+        size_t h = idom[b];
+        std::vector<bool> fwd(n, false), bwd(n, false);
+        std::deque<size_t> q;
+        for(size_t j : nxt[h])
+        if(j != h && !fwd[j]) {
+            fwd[j] = true;
+            q.push_back(j);
+        }
+        while(!q.empty()) {
+            size_t i = q.front();
+            q.pop_front();
+            for(size_t j : nxt[i])
+            if(j != h && !fwd[j]) {
+                fwd[j] = true;
+                q.push_back(j);
+            }
+        }
+        for(size_t j : pre[b])
+        if(j != h && !bwd[j]) {
+            bwd[j] = true;
+            q.push_back(j);
+        }
+        while(!q.empty()) {
+            size_t i = q.front();
+            q.pop_front();
+            for(size_t j : pre[i])
+            if(j != h && !bwd[j]) {
+                bwd[j] = true;
+                q.push_back(j);
+            }
+        }
+        std::vector<size_t> r;
+        for(size_t i = 0; i < n; ++i)
+        if(fwd[i] && bwd[i])
+            r.push_back(i);
+        return r;
+    };
+
+    struct Table {
+        std::map<std::string, size_t> vn;
+        std::map<std::string, size_t> expr;
+        std::map<size_t, std::set<std::string>> holders;
+        std::map<std::string, std::set<std::string>> loads;
+    };
+    size_t vnCnt = 0;
+
+    auto killVar = [&] (Table &t, const std::string &id) {
+        auto iter = t.vn.find(id);
+        if(iter == t.vn.end())
+            return;
+        t.holders[iter->second].erase(id);
+        t.vn.erase(iter);
+    };
+    auto killLoads = [&] (Table &t, const std::string &lab) {
+        for(const auto &key : t.loads[lab])
+            t.expr.erase(key);
+        t.loads.erase(lab);
+    };
+    // a callee can only write globals and global arrays, so values held in
+    // locals and temporaries, and loads from local arrays, survive the call
+    auto killCall = [&] (Table &t) {
+        auto shared = [&] (const std::string &id) {
+            return id[0] == '$' || local.lookup(id).type == TGlobalVariable;
+        };
+        std::vector<std::string> vars, arrays;
+        for(const auto &item : t.vn)
+        if(shared(item.first))
+            vars.push_back(item.first);
+        for(const auto &item : t.loads)
+        if(shared(item.first))
+            arrays.push_back(item.first);
+        for(const auto &id : vars)
+            killVar(t, id);
+        for(const auto &lab : arrays)
+            killLoads(t, lab);
+    };
+    auto valueOf = [&] (Table &t, const std::string &id) {
+        if(isImm(id))
+            return std::string("i") + id;
+        auto iter = t.vn.find(id);
+        if(iter == t.vn.end()) {
+            t.vn[id] = vnCnt;
+            t.holders[vnCnt].insert(id);
+            ++vnCnt;
+            return std::string("v") + std::to_string(vnCnt - 1);
+        }
+        return std::string("v") + std::to_string(iter->second);
+    };
+    auto assign = [&] (Table &t, const std::string &id, size_t v) {
+        killVar(t, id);
+        t.vn[id] = v;
+        t.holders[v].insert(id);
+    };
+    auto holderOf = [&] (Table &t, size_t v, const std::string &dst) {
+        std::string h;
+        for(const auto &id : t.holders[v]) {
+            if(id == dst)
+                return id;
+            if(h.empty() && canHold(id))
+                h = id;
+        }
+        return h;
+    };
+
+    auto number = [&] (Table &t, std::vector<MC> &block) {
+        std::vector<MC> nc;
+        for(const auto &c : block) {
+            MC r = c;
+            switch(c.o) {
+            case oli: {
+                auto key = std::string("li~") + c.a;
+                if(t.expr.find(key) == t.expr.end())
+                    t.expr[key] = vnCnt++;
+                assign(t, c.dst, t.expr[key]);
+                break;
+            }
+            case omov: {
+                valueOf(t, c.a);
+                size_t v = t.vn[c.a];
+                if(c.dst != c.a)
+                    assign(t, c.dst, v);
+                break;
+            }
+            case oneg:
+            case oadd:
+            case osub:
+            case omul:
+            case odiv:
+            case oloadarr: {
+                std::string key;
+                if(c.o == oloadarr) {
+                    key = std::string("ld~") + c.lab + "~" + valueOf(t, c.a);
+                } else {
+                    auto a = valueOf(t, c.a), b = c.o == oneg ? std::string() : valueOf(t, c.b);
+                    if((c.o == oadd || c.o == omul) && b[0] == 'v' && b < a)
+                        std::swap(a, b);
+                    key = std::to_string(size_t(c.o)) + "~" + a + "~" + b;
+                }
+                auto dst = mcDef(c);
+                auto iter = t.expr.find(key);
+                if(iter != t.expr.end()) {
+                    auto h = holderOf(t, iter->second, dst);
+                    if(!h.empty()) {
+                        #ifdef DEBUG
+                        std::cerr << "Optimized redundant value: " << dst << " <- " << h << std::endl;
+                        #endif
+                        ++stats[c.o == oloadarr ? "gvn.loads" : "gvn.exprs"];
+                        if(h == dst)
+                            continue;
+                        r = MC{omov, "", dst, h, "", c.line};
+                    }
+                    assign(t, dst, iter->second);
+                    break;
+                }
+                size_t v = vnCnt++;
+                assign(t, dst, v);
+                t.expr[key] = v;
+                if(c.o == oloadarr)
+                    t.loads[c.lab].insert(key);
+                break;
+            }
+            case ostorearr: {
+                killLoads(t, c.lab);
+                if(isIntArray(c.lab)) {
+                    auto key = std::string("ld~") + c.lab + "~" + valueOf(t, c.a);
+                    valueOf(t, c.b);
+                    t.expr[key] = t.vn[c.b];
+                    t.loads[c.lab].insert(key);
+                }
+                break;
+            }
+            case ocall:
+                killCall(t);
+                break;
+            case omovv0:
+            case orint:
+            case orchar:
+                killVar(t, c.dst);
+                break;
+            default:
+                break;
+            }
+            nc.push_back(r);
+        }
+        block.swap(nc);
+    };
+
+    std::vector<std::vector<size_t>> children(n);
+    for(size_t i = 1; i < n; ++i)
+    if(idom[i] < n)
+        children[idom[i]].push_back(i);
+
+    std::function<void(size_t, Table)> walk = [&] (size_t i, Table t) {
+        if(i != 0) {
+            bool call = false;
+            std::set<std::string> vars, arrays;
+            for(size_t j : region(i)) {
+                call |= kills[j].call;
+                vars.insert(kills[j].vars.begin(), kills[j].vars.end());
+                arrays.insert(kills[j].arrays.begin(), kills[j].arrays.end());
+            }
+            if(call)
+                killCall(t);
+            for(const auto &id : vars)
+                killVar(t, id);
+            for(const auto &lab : arrays)
+                killLoads(t, lab);
+        }
+        number(t, codes[i]);
+        for(size_t j : children[i])
+            walk(j, t);
+    };
+
+    if(n)
+        walk(0, Table());
+}
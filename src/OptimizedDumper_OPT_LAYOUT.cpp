@@ -0,0 +1,264 @@
+#include "OptimizedDumper.h"
+
+#include <set>
+#include <map>
+#include <cmath>
+#include <algorithm>
+
+void optLayout(const Function &local, std::vector<std::vector<MC>> &codes,
+        std::vector<std::string> &labels, OptimizedDumper &dumper) {
+    const std::set<OP> condOps {
+        obeq, obne, oblt, oble, obgt, obge, obeqz, obnez
+    };
+    static const std::map<OP, OP> inverse = {
+        {obeq, obne}, {obne, obeq}, {oblt, obge}, {obge, oblt},
+        {oble, obgt}, {obgt, oble}, {obeqz, obnez}, {obnez, obeqz}
+    };
+
+    auto &stats = dumper.stats[&local];
+    bool isMain = local.node.is("MainFunc");
+
+    // falling off the last block returns, which gets a block of its own so
+    // that every edge has a block on both ends
+    size_t n = codes.size();
+    bool synthetic = false;
+    if(!isMain && (codes[n - 1].empty() || (codes[n - 1].back().o != ojmp && codes[n - 1].back().o != oret))) {
+        codes.push_back({MC{oret, "", "", "", ""}});
+        labels.push_back("");
+        synthetic = true;
+        ++n;
+    }
+
+    std::map<std::string, size_t> revLabels;
+    for(size_t i = 0; i < n; ++i)
+    if(!labels[i].empty())
+        revLabels[labels[i]] = i;
+
+    // where each block falls through to and where its closing branch goes,
+    // n for neither
+    std::vector<size_t> fall(n, n), taken(n, n);
+    std::vector<std::vector<size_t>> nxt(n);
+    for(size_t i = 0; i < n; ++i) {
+        bool jumps = !codes[i].empty() && codes[i].back().o == ojmp,
+            returns = !codes[i].empty() && codes[i].back().o == oret;
+        if(jumps || (!codes[i].empty() && condOps.find(codes[i].back().o) != condOps.end()))
+            taken[i] = revLabels[codes[i].back().lab];
+        if(!jumps && !returns && i + 1 < n)
+            fall[i] = i + 1;
+        for(size_t j : {fall[i], taken[i]})
+        if(j != n)
+            nxt[i].push_back(j);
+    }
+
+    // natural loops, from the edges back to a block dominating their source
+    auto idom = optCalcIdom(nxt);
+    auto dominates = [&] (size_t d, size_t i) {
+        while(i != d && i != 0 && i != n)
+            i = idom[i];
+        return i == d;
+    };
+    auto isBack = [&] (size_t i, size_t j) {
+        return idom[i] != n && dominates(j, i);
+    };
+    std::vector<size_t> depth(n, 0);
+    std::map<size_t, std::set<size_t>> loops;
+    std::vector<std::vector<size_t>> pre(n);
+    for(size_t i = 0; i < n; ++i)
+    for(size_t j : nxt[i])
+        pre[j].push_back(i);
+    for(size_t i = 0; i < n; ++i)
+    for(size_t h : nxt[i])
+    if(isBack(i, h)) {
+        auto &body = loops[h];
+        std::vector<size_t> work {i};
+        body.insert(h);
+        while(!work.empty()) {
+            size_t b = work.back();
+            work.pop_back();
+            if(!body.insert(b).second)
+                continue;
+            work.insert(work.end(), pre[b].begin(), pre[b].end());
+        }
+    }
+    for(const auto &loop : loops)
+    for(size_t b : loop.second)
+        ++depth[b];
+    auto exits = [&] (size_t i, size_t j) {
+        for(const auto &loop : loops)
+        if(loop.second.count(i) && !loop.second.count(j))
+            return true;
+        return false;
+    };
+    auto enters = [&] (size_t i, size_t j) {
+        auto loop = loops.find(j);
+        return loop != loops.end() && !loop->second.count(i);
+    };
+
+    // edge weights: the profile when there is one for this very code,
+    // otherwise 10 per loop level, with 9 in 10 branches staying in or
+    // entering a loop
+    std::vector<double> wFall(n, 0), wTaken(n, 0);
+    auto profile = dumper.profile.find(local.identifier);
+    if(profile != dumper.profile.end() && profile->second.size() == n - synthetic) {
+        for(size_t i = 0; i < profile->second.size(); ++i) {
+            double count = (double)profile->second[i].first, t = (double)profile->second[i].second;
+            if(taken[i] != n)
+                wTaken[i] = fall[i] != n ? t : count;
+            if(fall[i] != n)
+                wFall[i] = count - wTaken[i];
+        }
+        #ifdef DEBUG
+        std::cerr << "Laying out " << local.identifier << " by its profile" << std::endl;
+        #endif
+    } else {
+        for(size_t i = 0; i < n; ++i) {
+            double freq = std::pow(10.0, (double)depth[i]), p = 1.0;
+            if(fall[i] != n && taken[i] != n) {
+                bool ef = exits(i, fall[i]), et = exits(i, taken[i]);
+                if(ef == et) {
+                    ef = enters(i, taken[i]);
+                    et = enters(i, fall[i]);
+                }
+                p = ef == et ? 0.5 : et ? 0.9 : 0.1;
+            }
+            if(fall[i] != n)
+                wFall[i] = freq * p;
+            if(taken[i] != n)
+                wTaken[i] = freq * (fall[i] != n ? 1.0 - p : 1.0);
+        }
+    }
+
+    // Pettis-Hansen: the heaviest edges join chains tail to head; a call
+    // and its continuation stay together, nothing enters the entry and
+    // main's end block is a chain of its own to be placed last; a loop
+    // closed by a conditional branch is already bottom-tested and keeps
+    // its header free to follow the code before it, one closed by a jump
+    // gets rotated here instead, its jump becoming a fall-through
+    std::vector<size_t> chainOf(n);
+    std::vector<std::vector<size_t>> chains(n);
+    for(size_t i = 0; i < n; ++i) {
+        chainOf[i] = i;
+        chains[i] = {i};
+    }
+    struct Edge {
+        double w;
+        bool isFall;
+        size_t from, to;
+    };
+    std::vector<Edge> edges;
+    for(size_t i = 0; i < n; ++i) {
+        bool calls = std::any_of(codes[i].begin(), codes[i].end(), [] (const MC &c) {
+            return c.o == ocall;
+        });
+        // a block with one way out saves its jump by being followed by its
+        // successor, a branch only turns into a fall-through the other way
+        double gain = fall[i] == n || taken[i] == n ? 2.0 : 1.0;
+        if(fall[i] != n)
+            edges.push_back(Edge{calls ? HUGE_VAL : gain * wFall[i], true, i, fall[i]});
+        if(taken[i] != n)
+            edges.push_back(Edge{gain * wTaken[i], false, i, taken[i]});
+    }
+    std::stable_sort(edges.begin(), edges.end(), [] (const Edge &a, const Edge &b) {
+        return a.w != b.w ? a.w > b.w : a.isFall > b.isFall;
+    });
+    for(const auto &e : edges) {
+        size_t a = chainOf[e.from], b = chainOf[e.to];
+        if(a == b || e.to == 0 || (isMain && e.to == n - 1) || (!e.isFall && fall[e.from] != n && isBack(e.from, e.to)) || chains[a].back() != e.from || chains[b].front() != e.to)
+            continue;
+        for(size_t k : chains[b])
+            chainOf[k] = a;
+        chains[a].insert(chains[a].end(), chains[b].begin(), chains[b].end());
+        chains[b].clear();
+    }
+
+    // the entry chain leads, then whichever chain the placed code enters
+    // most often
+    std::vector<size_t> order;
+    std::vector<bool> placed(n, false);
+    size_t last = isMain ? n - 1 : n;
+    auto place = [&] (size_t c) {
+        for(size_t k : chains[c]) {
+            order.push_back(k);
+            placed[k] = true;
+        }
+    };
+    place(chainOf[0]);
+    while(order.size() < n) {
+        std::map<size_t, double> score;
+        for(const auto &e : edges)
+        if(placed[e.from] && !placed[e.to])
+            score[chainOf[e.to]] += e.w;
+        size_t best = n;
+        for(size_t c = 0; c < n; ++c) {
+            if(chains[c].empty() || placed[chains[c].front()] || (c == last && order.size() + chains[c].size() < n))
+                continue;
+            if(best == n || score[c] > score[best])
+                best = c;
+        }
+        place(best);
+    }
+
+    if(synthetic && order.back() == n - 1 && order[n - 2] == n - 2) {
+        order.pop_back();
+        codes.pop_back();
+        labels.pop_back();
+        --n;
+        // n stays the mark for no successor
+        for(size_t i = 0; i < n; ++i) {
+            if(fall[i] >= n)
+                fall[i] = n;
+            if(taken[i] >= n)
+                taken[i] = n;
+        }
+    }
+
+    auto labelOf = [&] (size_t b) {
+        if(labels[b].empty())
+            labels[b] = local.entryLabel() + "_b" + std::to_string(b);
+        return labels[b];
+    };
+    std::vector<std::vector<MC>> nc;
+    std::vector<std::string> nl;
+    std::vector<std::pair<size_t, std::vector<MC>>> after;
+    for(size_t p = 0; p < order.size(); ++p) {
+        size_t b = order[p], next = p + 1 < order.size() ? order[p + 1] : n;
+        auto &block = codes[b];
+        if(fall[b] == next || fall[b] == n) {
+            if(!block.empty() && block.back().o == ojmp && taken[b] == next) {
+                block.pop_back();
+                ++stats["layout.jumps"];
+            }
+        } else if(taken[b] != n && taken[b] == next) {
+            block.back().o = inverse.at(block.back().o);
+            block.back().lab = labelOf(fall[b]);
+            ++stats["layout.inverted"];
+        } else if(taken[b] != n) {
+            after.push_back({b, {MC{ojmp, labelOf(fall[b]), "", "", ""}}});
+        } else {
+            block.push_back(MC{ojmp, labelOf(fall[b]), "", "", ""});
+        }
+    }
+    for(size_t p = 0; p < order.size(); ++p) {
+        size_t b = order[p];
+        nc.push_back(codes[b]);
+        nl.push_back(labels[b]);
+        for(const auto &item : after)
+        if(item.first == b) {
+            nc.push_back(item.second);
+            nl.push_back("");
+            ++stats["layout.jumps.added"];
+        }
+    }
+    #ifdef DEBUG
+    std::cerr << "Laid out " << local.identifier << ":";
+    for(size_t b : order)
+        std::cerr << " " << b;
+    std::cerr << std::endl;
+    #endif
+    for(size_t p = 0; p < order.size(); ++p)
+    if(order[p] != p) {
+        ++stats["layout.moved"];
+    }
+    codes.swap(nc);
+    labels.swap(nl);
+}
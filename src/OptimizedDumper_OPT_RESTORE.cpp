@@ -40,7 +40,7 @@ void optRestore(const Function &local,
 
     const std::set<OP> retainOps {
         oli, oneg, omov, omovv0, oarg,
-        oadd, osub, omul, odiv,
+        oadd, osub, omul, odiv, omod,
         oloadarr, ostorearr
     }, endOps {
         ojmp, obeq, obne, oblt, oble, obgt, obge,
@@ -126,18 +126,18 @@ void optRestore(const Function &local,
         oret, opint, opchar
     }, useAOps {
         omov, oneg,
-        oadd, osub, omul, odiv,
+        oadd, osub, omul, odiv, omod,
         oloadarr, ostorearr,
         obeqz, obnez,
         obeq, obne, oblt, oble, obgt, obge,
         oarg
     }, useBOps {
-        oadd, osub, omul, odiv,
+        oadd, osub, omul, odiv, omod,
         ostorearr,
         obeq, obne, oblt, oble, obgt, obge
     }, geneDstOps {
         oli, oneg, omov, omovv0,
-        oadd, osub, omul, odiv
+        oadd, osub, omul, odiv, omod
     };
 
     auto inlineUsing = [&] (const std::vector<MC> &code) {
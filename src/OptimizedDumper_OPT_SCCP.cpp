@@ -0,0 +1,386 @@
+#include "OptimizedDumper.h"
+
+#include <set>
+#include <map>
+#include <deque>
+#include <limits>
+#include <algorithm>
+
+static bool isId(const std::string &id) {
+    return !id.empty() && id[0] != '#' && id[0] != '-' && !isdigit(id[0]) && id[0] != '$';
+}
+
+static bool isImm(const std::string &id) {
+    return !id.empty() && (id[0] == '-' || isdigit(id[0]));
+}
+
+struct SCCPValue {
+    enum { Top, Const, Bottom } state;
+    int32_t val;
+    bool operator==(const SCCPValue &v) const {
+        return state == v.state && (state != Const || val == v.val);
+    }
+    bool operator!=(const SCCPValue &v) const {
+        return !(*this == v);
+    }
+};
+
+static bool foldOp(OP o, int32_t a, int32_t b, int32_t &r) {
+    switch(o) {
+    case oadd:
+        r = (int32_t)((uint32_t)a + (uint32_t)b);
+        return true;
+    case osub:
+        r = (int32_t)((uint32_t)a - (uint32_t)b);
+        return true;
+    case omul:
+        r = (int32_t)((uint32_t)a * (uint32_t)b);
+        return true;
+    case odiv:
+        if(b == 0 || (a == std::numeric_limits<int32_t>::min() && b == -1))
+            return false;
+        r = a / b;
+        return true;
+    default:
+        break;
+    }
+    return false;
+}
+
+static bool compareOp(OP o, int32_t a, int32_t b) {
+    switch(o) {
+    case obeq:
+    case obeqz:
+        return a == b;
+    case obne:
+    case obnez:
+        return a != b;
+    case oblt:
+        return a < b;
+    case oble:
+        return a <= b;
+    case obgt:
+        return a > b;
+    case obge:
+        return a >= b;
+    default:
+        assert(false);
+        break;
+    }
+    return false;
+}
+
+void optSCCP(const Function &local, std::vector<std::vector<MC>> &codes,
+        std::vector<std::string> &labels, OptimizedDumper &dumper) {
+    const std::set<OP> condOps {
+        obeq, obne, oblt, oble, obgt, obge, obeqz, obnez
+    };
+    const std::map<OP, OP> mirror {
+        {obeq, obeq}, {obne, obne}, {oblt, obgt}, {oble, obge}, {obgt, oblt}, {obge, oble}
+    };
+
+    typedef std::map<std::string, SCCPValue> State;
+
+    auto &stats = dumper.stats[&local];
+
+    std::map<std::string, size_t> revLabels;
+    for(size_t i = 0; i < labels.size(); ++i)
+    if(!labels[i].empty())
+        revLabels[labels[i]] = i;
+
+    auto tracked = [&] (const std::string &id) {
+        return isId(id) && local.lookup(id).type != TGlobalVariable;
+    };
+
+    auto valueOf = [&] (const State &st, const std::string &id) -> SCCPValue {
+        if(isImm(id)) {
+            int32_t v;
+            sscanf(id.c_str(), "%d", &v);
+            return SCCPValue{SCCPValue::Const, v};
+        }
+        if(!tracked(id))
+            return SCCPValue{SCCPValue::Bottom, 0};
+        auto iter = st.find(id);
+        if(iter == st.end())
+            return SCCPValue{SCCPValue::Top, 0};
+        return iter->second;
+    };
+
+    auto evaluate = [&] (const State &st, const MC &c) -> SCCPValue {
+        switch(c.o) {
+        case oli:
+            return valueOf(st, c.a);
+        case omov:
+            return valueOf(st, c.a);
+        case oneg: {
+            SCCPValue v = valueOf(st, c.a);
+            if(v.state == SCCPValue::Const)
+                v.val = (int32_t)(0u - (uint32_t)v.val);
+            return v;
+        }
+        case oadd:
+        case osub:
+        case omul:
+        case odiv: {
+            SCCPValue va = valueOf(st, c.a), vb = valueOf(st, c.b);
+            if(c.o == omul && ((va.state == SCCPValue::Const && va.val == 0)
+                    || (vb.state == SCCPValue::Const && vb.val == 0)))
+                return SCCPValue{SCCPValue::Const, 0};
+            if(va.state == SCCPValue::Const && vb.state == SCCPValue::Const) {
+                int32_t r;
+                if(foldOp(c.o, va.val, vb.val, r))
+                    return SCCPValue{SCCPValue::Const, r};
+                return SCCPValue{SCCPValue::Bottom, 0};
+            }
+            if(va.state == SCCPValue::Bottom || vb.state == SCCPValue::Bottom)
+                return SCCPValue{SCCPValue::Bottom, 0};
+            return SCCPValue{SCCPValue::Top, 0};
+        }
+        default:
+            break;
+        }
+        return SCCPValue{SCCPValue::Bottom, 0};
+    };
+
+    auto transfer = [&] (State &st, const MC &c) {
+        auto d = mcDef(c);
+        if(tracked(d))
+            st[d] = evaluate(st, c);
+    };
+
+    // -1: not decidable yet, 0: never taken, 1: always taken, 2: both ways
+    auto decide = [&] (const State &st, const MC &c) -> int {
+        SCCPValue va = valueOf(st, c.a);
+        SCCPValue vb = (c.o == obeqz || c.o == obnez) ? SCCPValue{SCCPValue::Const, 0} : valueOf(st, c.b);
+        if(c.a == c.b && isId(c.a))
+            return compareOp(c.o, 0, 0) ? 1 : 0;
+        if(va.state == SCCPValue::Const && vb.state == SCCPValue::Const)
+            return compareOp(c.o, va.val, vb.val) ? 1 : 0;
+        if(va.state == SCCPValue::Top || vb.state == SCCPValue::Top)
+            return -1;
+        return 2;
+    };
+
+    auto successors = [&] (size_t i, const State &st) {
+        std::vector<size_t> s;
+        bool fall = true;
+        if(!codes[i].empty()) {
+            const MC &c = codes[i].back();
+            if(c.o == ojmp) {
+                s.push_back(revLabels[c.lab]);
+                fall = false;
+            } else if(c.o == oret) {
+                fall = false;
+            } else if(condOps.find(c.o) != condOps.end()) {
+                int d = decide(st, c);
+                if(d == 1 || d == 2)
+                    s.push_back(revLabels[c.lab]);
+                fall = d == 0 || d == 2;
+            }
+        }
+        if(fall && i + 1 < codes.size())
+            s.push_back(i + 1);
+        return s;
+    };
+
+    auto meet = [&] (const State &a, const State &b) {
+        State r = a;
+        for(const auto &item : b) {
+            auto iter = r.find(item.first);
+            if(iter == r.end() || iter->second.state == SCCPValue::Top)
+                r[item.first] = item.second;
+            else if(item.second.state != SCCPValue::Top && iter->second != item.second)
+                iter->second = SCCPValue{SCCPValue::Bottom, 0};
+        }
+        return r;
+    };
+
+    size_t n = codes.size();
+    std::vector<State> in(n), out(n);
+    std::vector<bool> executable(n, false);
+    std::vector<std::set<size_t>> execPreds(n);
+
+    for(const auto &block : codes)
+    for(const auto &c : block) {
+        if(tracked(mcDef(c)))
+            in[0][mcDef(c)] = SCCPValue{SCCPValue::Bottom, 0};
+        for(const auto &id : mcUses(c))
+        if(tracked(id))
+            in[0][id] = SCCPValue{SCCPValue::Bottom, 0};
+    }
+
+    std::deque<size_t> worklist {0};
+    executable[0] = true;
+    while(!worklist.empty()) {
+        size_t i = worklist.front();
+        worklist.pop_front();
+
+        State st = in[i];
+        for(const auto &c : codes[i])
+            transfer(st, c);
+        out[i] = st;
+
+        for(size_t j : successors(i, st)) {
+            execPreds[j].insert(i);
+            if(j == 0)
+                continue;
+            State m;
+            for(size_t p : execPreds[j])
+                m = meet(m, out[p]);
+            if(!executable[j] || m != in[j]) {
+                executable[j] = true;
+                in[j] = m;
+                if(std::find(worklist.begin(), worklist.end(), j) == worklist.end())
+                    worklist.push_back(j);
+            }
+        }
+    }
+
+    auto constOf = [&] (const State &st, const std::string &id, int32_t &v) {
+        SCCPValue x = valueOf(st, id);
+        if(x.state != SCCPValue::Const)
+            return false;
+        v = x.val;
+        return true;
+    };
+
+    for(size_t i = 0; i < n; ++i) {
+        if(!executable[i])
+            continue;
+        State st = in[i];
+        std::vector<MC> nc;
+        for(const auto &c : codes[i]) {
+            MC r = c;
+            bool drop = false;
+            int32_t va, vb;
+            switch(c.o) {
+            case omov:
+            case oneg:
+                if(constOf(st, c.a, va)) {
+                    r = MC{oli, "", c.dst, std::to_string(evaluate(st, c).val), "", c.line};
+                    ++stats["sccp.folded"];
+                }
+                break;
+            case oadd:
+            case osub:
+            case omul:
+            case odiv: {
+                SCCPValue v = evaluate(st, c);
+                if(v.state == SCCPValue::Const) {
+                    r = MC{oli, "", c.dst, std::to_string(v.val), "", c.line};
+                    ++stats["sccp.folded"];
+                    break;
+                }
+                bool ca = constOf(st, c.a, va), cb = constOf(st, c.b, vb);
+                if(cb && !isImm(c.b)) {
+                    r.b = std::to_string(vb);
+                    ++stats["sccp.propagated"];
+                }
+                if(ca && !cb && (c.o == oadd || c.o == omul)) {
+                    r.a = c.b;
+                    r.b = std::to_string(va);
+                    ++stats["sccp.propagated"];
+                }
+                if(!isImm(r.b))
+                    break;
+                sscanf(r.b.c_str(), "%d", &vb);
+                if(r.o == osub && vb != std::numeric_limits<int32_t>::min()) {
+                    r.o = oadd;
+                    vb = -vb;
+                    r.b = std::to_string(vb);
+                }
+                if((r.o == oadd && vb == 0) || ((r.o == omul || r.o == odiv) && vb == 1)) {
+                    r = MC{omov, "", r.dst, r.a, "", c.line};
+                    drop = r.dst == r.a;
+                } else if((r.o == omul || r.o == odiv) && vb == -1) {
+                    r = MC{oneg, "", r.dst, r.a, "", c.line};
+                }
+                break;
+            }
+            case oloadarr:
+            case ostorearr:
+                // a constant index becomes an address offset
+                if(constOf(st, c.a, va) && !isImm(c.a)) {
+                    r.a = std::to_string(va);
+                    ++stats["sccp.propagated"];
+                }
+                break;
+            case obeq:
+            case obne:
+            case oblt:
+            case oble:
+            case obgt:
+            case obge:
+            case obeqz:
+            case obnez: {
+                int d = decide(st, c);
+                if(d == 0 || d == 1) {
+                    #ifdef DEBUG
+                    std::cerr << "Optimized constant branch to " << c.lab
+                        << " in block " << i << ": " << (d ? "always" : "never") << " taken" << std::endl;
+                    #endif
+                    if(d)
+                        r = MC{ojmp, c.lab, "", "", "", c.line};
+                    drop = !d;
+                    ++stats["sccp.branches"];
+                    break;
+                }
+                if(c.o == obeqz || c.o == obnez)
+                    break;
+                bool ca = constOf(st, c.a, va), cb = constOf(st, c.b, vb);
+                if(cb && !isImm(c.b)) {
+                    r.b = std::to_string(vb);
+                    ++stats["sccp.propagated"];
+                } else if(ca) {
+                    r.o = mirror.at(c.o);
+                    r.a = c.b;
+                    r.b = std::to_string(va);
+                    ++stats["sccp.propagated"];
+                }
+                if((r.o == obeq || r.o == obne) && r.b == "0") {
+                    r.o = r.o == obeq ? obeqz : obnez;
+                    r.b = "";
+                }
+                break;
+            }
+            case oret:
+            case opint:
+            case opchar:
+                if(isId(c.dst) && constOf(st, c.dst, va)) {
+                    r.dst = std::to_string(va);
+                    ++stats["sccp.propagated"];
+                }
+                break;
+            default:
+                break;
+            }
+            transfer(st, c);
+            if(!drop)
+                nc.push_back(r);
+        }
+        codes[i].swap(nc);
+    }
+
+    std::vector<bool> keep(executable);
+    keep[0] = true;
+    for(size_t i = 0; i < n; ++i)
+    if(keep[i] && !codes[i].empty() && (codes[i].back().o == ojmp
+            || condOps.find(codes[i].back().o) != condOps.end()))
+        keep[revLabels[codes[i].back().lab]] = true;
+
+    for(size_t i = 0; i < n; ++i) {
+        if(keep[i])
+            continue;
+        #ifdef DEBUG
+        if(labels[i].empty())
+            std::cerr << "Removed unreachable block " << i << std::endl;
+        else
+            std::cerr << "Removed unreachable block " << i << " (" << labels[i] << ")" << std::endl;
+        #endif
+        ++stats["sccp.blocks"];
+        if(!codes[i].empty())
+            stats["sccp.instructions"] += codes[i].size();
+    }
+
+    optRemoveBlocks(codes, labels, keep);
+}
@@ -0,0 +1,66 @@
+#include "OptimizedDumper.h"
+
+#include <set>
+#include <map>
+
+// whether control returns right after block i without doing anything else,
+// handing back the value of the call when there is one
+static bool returnsAfter(const Function &local, const std::vector<std::vector<MC>> &codes, size_t i) {
+    size_t j = i + 1;
+    while(j < codes.size() && codes[j].empty())
+        ++j;
+    if(j == codes.size())
+        return !local.node.is("MainFunc");
+    const auto &block = codes[j];
+    if(block.size() == 1)
+        return block[0].o == oret && block[0].dst.empty();
+    return block.size() == 2 && block[0].o == omovv0 && block[0].a.empty()
+        && block[1].o == oret && block[1].dst == block[0].dst;
+}
+
+void optTailRecursion(Function &local, std::vector<std::vector<MC>> &codes,
+        std::vector<std::string> &labels, OptimizedDumper &dumper) {
+    auto &stats = dumper.stats[&local];
+
+    std::vector<size_t> sites;
+    for(size_t i = 0; i < codes.size(); ++i)
+    if(!codes[i].empty() && codes[i].back().o == ocall && codes[i].back().lab == local.identifier
+            && returnsAfter(local, codes, i))
+        sites.push_back(i);
+    if(sites.empty())
+        return;
+
+    // nothing may branch to the entry block, so the body moves behind an
+    // empty one and becomes the loop header
+    std::string header = local.entryLabel() + "_tail";
+    codes.insert(codes.begin(), std::vector<MC>());
+    labels.insert(labels.begin(), labels[0]);
+    labels[1] = header;
+
+    for(size_t i : sites) {
+        auto &block = codes[i + 1];
+        // the arguments are temporaries of their own, so the parameters can
+        // be overwritten one after another
+        std::vector<MC> nc;
+        for(const auto &c : block) {
+            if(c.o == oarg) {
+                size_t k;
+                sscanf(c.dst.c_str(), "%zu", &k);
+                nc.push_back(MC{
+                    omov, "", local.paramList[k].identifier, c.a, "", c.line
+                });
+            } else if(c.o == ocall) {
+                nc.push_back(MC{
+                    ojmp, header, "", "", "", c.line
+                });
+            } else {
+                nc.push_back(c);
+            }
+        }
+        block.swap(nc);
+        #ifdef DEBUG
+        std::cerr << "Turned tail recursion in block " << i << " into a jump to " << header << std::endl;
+        #endif
+        ++stats["tail.recursion"];
+    }
+}
@@ -7,10 +7,16 @@ static std::string tempLab() {
     return std::string("__label_") + std::to_string(cnt++);
 }
 
-void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &codes, std::vector<std::string> &labels) {
+void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &codes, std::vector<std::string> &labels,
+        OptimizedDumper &dumper) {
     std::function<const Function *(const ASTNode &)> involk;
     std::function<std::tuple<std::string, VarType>(const ASTNode &, const std::string &)> expression, requireId, item, factor;
 
+    // fully unrolled loops run at most unrollFull times and weigh at most
+    // unrollFullWeight in AST nodes, budget is what copies may add in total
+    const size_t unrollFull = 16, unrollFullWeight = 256;
+    size_t budget = dumper.unrollBudget;
+
     size_t tvCnt = 0;
     auto tempVar = [&] {
         return std::string("tempVar$") + std::to_string(tvCnt++);
@@ -20,6 +26,13 @@ void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &co
     labels.emplace_back(local.entryLabel());
     size_t current = 0;
 
+    // source line of the statement being lowered, stamped on what it emits
+    size_t line = node.startIter->getPos().getLineNumber() + 1;
+    auto emit = [&] (MC c) {
+        c.line = line;
+        codes[current].push_back(c);
+    };
+
     auto newBlock = [&] (const std::string &label) {
         codes.emplace_back(std::vector<MC>());
         labels.emplace_back(label);
@@ -27,18 +40,18 @@ void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &co
     };
 
     auto jump = [&] (const std::string &label) {
-        codes[current].emplace_back(MC{
+        emit(MC{
             ojmp, label, "", "", ""
         });
     };
     auto ret = [&] (const std::string &id) {
-        codes[current].emplace_back(MC{
+        emit(MC{
             oret, "", id, "", ""
         });
     };
 
     auto arr = [&] (OP o, const std::string &a, const std::string &i, const std::string &v) {
-        codes[current].emplace_back(MC{
+        emit(MC{
             o, a, "", i, v
         });
     };
@@ -57,7 +70,7 @@ void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &co
         if(o == omov && a == b) {
             return;
         }
-        codes[current].emplace_back(MC{
+        emit(MC{
             o, "", a, b, ""
         });
     };
@@ -79,7 +92,7 @@ void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &co
             si(oli, dst, "0");
             return;
         }
-        codes[current].emplace_back(MC{
+        emit(MC{
             o, "", dst, a, b
         });
     };
@@ -99,11 +112,11 @@ void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &co
             ids.push_back(tid);
         }
         for(size_t i = 0; i < ids.size(); ++i) {
-            codes[current].emplace_back(MC{
+            emit(MC{
                 oarg, f->identifier, std::to_string(i), ids[i], ""
             });
         }
-        codes[current].emplace_back(MC{
+        emit(MC{
             ocall, f->identifier, "", "", ""
         });
         newBlock("");
@@ -113,7 +126,7 @@ void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &co
     auto printStatement = [&] (const ASTNode &node) {
         if(node.hasChild("string")) {
             std::string s = local.addStringLiteral(node.getChild("string"));
-            codes[current].emplace_back(MC{
+            emit(MC{
                 opstr, s, "", "", ""
             });
             newBlock("");
@@ -124,11 +137,11 @@ void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &co
         VarType t;
         std::tie(e, t) = expression(node.getChild("expression"), tid);
         if(t == VarCharType || t == VarCharImm) {
-            codes[current].emplace_back(MC{
+            emit(MC{
                 opchar, "", e, "", ""
             });
         } else {
-            codes[current].emplace_back(MC{
+            emit(MC{
                 opint, "", e, "", ""
             });
         }
@@ -144,7 +157,7 @@ void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &co
             case TGlobalVariable:
             case TLocalVariable: {
                 const auto &v = *res.result.v;
-                codes[current].emplace_back(MC{
+                emit(MC{
                     v.type == VarIntType ? orint : orchar, "", id, "", ""
                 });
                 newBlock("");
@@ -492,6 +505,90 @@ void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &co
         }
     };
 
+    // the value of an expression that folds without emitting code
+    std::function<bool(const ASTNode &)> hasCall = [&] (const ASTNode &node) {
+        if(node.is("InvolkExpression"))
+            return true;
+        for(const auto &c : node)
+        if(hasCall(c))
+            return true;
+        return false;
+    };
+    auto constant = [&] (const ASTNode &node, int32_t &v) {
+        if(hasCall(node))
+            return false;
+        auto &block = codes[current];
+        size_t n = block.size();
+        std::string e;
+        VarType t;
+        std::tie(e, t) = expression(node, tempVar());
+        block.erase(block.begin() + (std::ptrdiff_t)n, block.end());
+        if(t != VarIntImm && t != VarCharImm)
+            return false;
+        sscanf(e.c_str(), "%d", &v);
+        return true;
+    };
+    // whether an expression is nothing but the plain variable id
+    auto isVariable = [&] (const ASTNode &node, const std::string &id) {
+        const ASTNode *n = &node;
+        while(!n->is("Factor") && n->getChildren().size() == 1)
+            n = &n->getChildren()[0];
+        return n->is("Factor") && n->hasChild("identifier") && !n->hasChild("index")
+            && n->getChild("identifier").valIter->str() == id;
+    };
+    std::function<bool(const ASTNode &, const std::string &)> writes = [&] (const ASTNode &node, const std::string &id) {
+        if(node.is("AssignmentStatement") && !node.hasChild("index")
+                && node.getChild("identifier").valIter->str() == id)
+            return true;
+        if(node.is("ForStatement") && node.getChild("idA").valIter->str() == id)
+            return true;
+        if(node.is("ScanStatement"))
+            for(const auto &c : node)
+            if(c.valIter->str() == id)
+                return true;
+        for(const auto &c : node)
+        if(writes(c, id))
+            return true;
+        return false;
+    };
+    std::function<size_t(const ASTNode &)> weight = [&] (const ASTNode &node) {
+        size_t w = 1;
+        for(const auto &c : node)
+            w += weight(c);
+        return w;
+    };
+
+    // number of iterations of for(id = init; condition; id = id + step)
+    // when it is a constant no larger than maxTrip
+    auto tripCount = [&] (const ASTNode &node, const std::string &id, int32_t init, int32_t step, size_t &trip) {
+        const auto &cond = node.getChild("condition");
+        std::string op = "!=";
+        int32_t bound = 0;
+        bool flip = false;
+        if(cond.hasChild("expressionB")) {
+            op = cond.getChild("op").valIter->str();
+            flip = !isVariable(cond.getChild("expressionA"), id);
+            if(!isVariable(cond.getChild(flip ? "expressionB" : "expressionA"), id)
+                    || !constant(cond.getChild(flip ? "expressionA" : "expressionB"), bound))
+                return false;
+        } else if(!isVariable(cond.getChild("expressionA"), id)) {
+            return false;
+        }
+        auto holds = [&] (int64_t v) {
+            int64_t a = flip ? bound : v, b = flip ? v : bound;
+            return op == "==" ? a == b : op == "!=" ? a != b : op == "<" ? a < b
+                : op == "<=" ? a <= b : op == ">" ? a > b : a >= b;
+        };
+        const size_t maxTrip = 1 << 16;
+        int64_t v = init;
+        for(trip = 0; holds(v); ++trip) {
+            v += step;
+            if(trip >= maxTrip || v < INT32_MIN || v > INT32_MAX)
+                return false;
+        }
+        return true;
+    };
+
     auto forStatement = [&] (const ASTNode &node) {
         auto id = node.getChild("idA").valIter->str();
         auto res = local.lookup(id);
@@ -508,16 +605,64 @@ void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &co
             Logger::getInstance().error(node.getChild("idA"), "unmatched type");
             return;
         }
-        auto l = tempLab(), r = tempLab();
-        newBlock(l);
-        condition(r, true, node.getChild("condition"));
-        statement(node.getChild("statement"));
         int32_t step = (int32_t)node.getChild("step").valIter->getVal<uint32_t>();
         if(std::string("-") == node.getChild("op").valIter->tokenType.indicator)
             step = -step;
-        bi(oadd, id, id, std::to_string(step));
-        jump(l);
+        const auto &body = node.getChild("statement");
+        auto iteration = [&] {
+            statement(body);
+            bi(oadd, id, id, std::to_string(step));
+        };
+
+        // constant trip counts unroll: tiny loops completely, larger ones
+        // by unrollFactor with the leftover iterations behind the loop,
+        // as long as the copies fit what is left of the budget
+        int32_t first;
+        size_t trip;
+        if(dumper.unrollFactor > 1 && v.type == VarIntType && res.type != TGlobalVariable
+                && step != 0 && !writes(body, id) && constant(node.getChild("init"), first)
+                && tripCount(node, id, first, step, trip)) {
+            size_t w = weight(body), factor = dumper.unrollFactor;
+            if(trip <= unrollFull && trip * w <= unrollFullWeight && (trip ? trip - 1 : 0) * w <= budget) {
+                #ifdef DEBUG
+                std::cerr << "Unrolled loop over " << id << " completely: " << trip << " iterations" << std::endl;
+                #endif
+                budget -= (trip ? trip - 1 : 0) * w;
+                for(size_t k = 0; k < trip; ++k)
+                    iteration();
+                ++dumper.stats[&local]["unroll.full"];
+                return;
+            }
+            if(trip >= 2 * factor && (factor - 1 + trip % factor) * w <= budget) {
+                #ifdef DEBUG
+                std::cerr << "Unrolled loop over " << id << " by " << factor << ": " << trip << " iterations" << std::endl;
+                #endif
+                budget -= (factor - 1 + trip % factor) * w;
+                // at least one pass runs, so the test sits at the bottom only
+                int64_t last = (int64_t)first + (int64_t)(trip - trip % factor) * step;
+                auto l = tempLab();
+                newBlock(l);
+                for(size_t k = 0; k < factor; ++k)
+                    iteration();
+                br(step > 0 ? oblt : obgt, l, id, std::to_string(last));
+                newBlock("");
+                for(size_t k = 0; k < trip % factor; ++k)
+                    iteration();
+                ++dumper.stats[&local]["unroll.partial"];
+                return;
+            }
+        }
+
+        // rotated: a guard skips the loop once, then the condition at the
+        // bottom branches back, one branch per iteration instead of a
+        // branch and a jump
+        auto l = tempLab(), r = tempLab();
+        condition(r, true, node.getChild("condition"));
+        newBlock(l);
+        iteration();
+        condition(l, false, node.getChild("condition"));
         newBlock(r);
+        ++dumper.stats[&local]["loop.rotated"];
     };
 
     auto assignmentStatement = [&] (const ASTNode &node) {
@@ -563,6 +708,10 @@ void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &co
 
     statement = [&] (const ASTNode &node) {
         for(const auto &c : node) {
+            // what a compound statement emits after its parts, like the
+            // test at the bottom of a loop, is its own again
+            size_t outer = line;
+            line = c.startIter->getPos().getLineNumber() + 1;
             if(c.is("Statement")) {
                 statement(c);
             } else if(c.is("AssignmentStatement")) {
@@ -582,6 +731,7 @@ void toMC(Function &local, const ASTNode &node, std::vector<std::vector<MC>> &co
             } else if(c.is("InvolkStatement")) {
                 involk(c);
             }
+            line = outer;
         }
     };
 
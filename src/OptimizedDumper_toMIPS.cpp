@@ -1,5 +1,8 @@
 #include "OptimizedDumper.h"
 
+#include <set>
+#include <map>
+
 struct _code_ {
     std::string s;
     _code_(): s() {}
@@ -30,26 +33,241 @@ void optToMIPS(Function &local, OptimizedDumper &dumper) {
         return res.result.f->paramList[i].type == VarCharType ? "sb" : "sw";
     };
 
-    auto hasStInter = dumper.hasStInter[&local];
+    // only variables that live in memory get a slot, $ra only when something
+    // is called; a leaf keeping everything in registers has no frame at all
     auto hasCall = dumper.hasCall[&local];
-    size_t stackSize = local.varList.space() + 4 + local.paramList.space();
+    const auto &frameVars = dumper.frameVars[&local];
+    auto inFrame = [&] (const std::string &id) {
+        return frameVars.find(id) != frameVars.end();
+    };
+
+    // a call followed by nothing but a return leaves through the callee: the
+    // frame goes first and the callee's stack arguments overlay our incoming
+    // ones, so no slot may be touched once an argument has been written to it;
+    // maps the block to where frame stores turn dead and where the call is
+    std::map<size_t, std::pair<size_t, size_t>> tailCalls;
+    size_t calls = 0;
+    for(size_t i = 0; i < entities.size() && !local.node.is("MainFunc"); ++i) {
+        const auto &block = entities[i];
+        size_t c = 0;
+        while(c < block.size() && block[c].o != ocall)
+            ++c;
+        if(c == block.size())
+            continue;
+        ++calls;
+        // only the reloads of saved registers follow the call
+        bool ok = true;
+        for(size_t k = c + 1; k < block.size(); ++k)
+            ok = ok && block[k].o == omov && block[k].dst[0] == '$' && inFrame(block[k].a);
+        size_t j = i + 1;
+        while(j < entities.size() && entities[j].empty())
+            ++j;
+        if(j < entities.size())
+            ok = ok && entities[j].front().o == oret
+                && (entities[j].front().dst.empty() || entities[j].front().dst == "$v0");
+        // the frame is still in use up to its last read, stores behind that
+        // are dead; a stack argument only lands on the parameter of the same
+        // position, but may reach past them into the locals
+        auto frameRead = [&] (const MC &code) {
+            if(code.o == omov && code.dst[0] == '$' && inFrame(code.a))
+                return code.a;
+            if((code.o == oloadarr || code.o == ostorearr) && inFrame(code.lab))
+                return code.lab;
+            return std::string();
+        };
+        size_t last = 0;
+        for(size_t k = 0; k < c; ++k)
+        if(!frameRead(block[k]).empty())
+            last = k + 1;
+        std::set<int64_t> written;
+        for(size_t k = 0; k < last; ++k) {
+            const auto &code = block[k];
+            if(code.o == oarg) {
+                size_t a;
+                sscanf(code.dst.c_str(), "%zu", &a);
+                written.insert(calcArgRela(a));
+                continue;
+            }
+            std::string v = frameRead(code);
+            if(v.empty() && code.o == omov && code.dst[0] != '$' && inFrame(code.dst))
+                v = code.dst;
+            if(v.empty())
+                continue;
+            ok = ok && (local.paramList.hasVariable(v)
+                ? !written.count(-(int64_t)local.paramList.getAddress(v) - 4)
+                : written.empty());
+        }
+        if(ok)
+            tailCalls[i] = {last, c};
+    }
+    bool saveRa = hasCall && !local.node.is("MainFunc") && tailCalls.size() < calls;
 
-    std::map<std::string, std::pair<size_t, char>> rela;
-    for(size_t i = 0; i < local.varList.size(); ++i)
-        rela[local.varList[i].identifier] = {local.varList.getAddress(i),
-            local.varList[i].type == VarCharType || local.varList[i].type == VarCharArray ? 'b' : 'w'};
-    rela["$ra"] = {local.varList.space(), 'w'};
+    std::map<std::string, std::pair<int64_t, char>> rela;
+    int64_t localSize = 0;
+    for(size_t i = 0; i < local.varList.size(); ++i) {
+        const auto &v = local.varList[i];
+        if(frameVars.find(v.identifier) == frameVars.end())
+            continue;
+        rela[v.identifier] = {localSize, v.type == VarCharType || v.type == VarCharArray ? 'b' : 'w'};
+        localSize += v.spaceAligned();
+    }
+    if(saveRa)
+        rela["$ra"] = {localSize, 'w'};
+    // parameters live right below the caller's $sp, which is the top of this
+    // frame, or below our own $sp when there is none; the frame reaches up
+    // to the last one kept in memory
+    int64_t paramSize = 0;
     for(size_t i = 0; i < local.paramList.size(); ++i)
-        rela[local.paramList[i].identifier] = {stackSize - local.paramList.getAddress(i) - 4,
+    if(inFrame(local.paramList[i].identifier))
+        paramSize = std::max(paramSize, (int64_t)local.paramList.getAddress(i) + 4);
+    int64_t stackSize = localSize || saveRa ? localSize + (saveRa ? 4 : 0) + paramSize : 0;
+    for(size_t i = 0; i < local.paramList.size(); ++i)
+    if(inFrame(local.paramList[i].identifier))
+        rela[local.paramList[i].identifier] = {stackSize - (int64_t)local.paramList.getAddress(i) - 4,
             local.paramList[i].type == VarCharType ? 'b' : 'w'};
 
-    auto &asmCode = dumper.text[local.identifier];
+    // shrink-wrapping: the frame is set up in front of the block dominating
+    // every block that touches it, so paths that never do, say the base case
+    // of a recursion, run without it; the blocks dominated there must not
+    // lead back into it or out of it other than by returning
+    size_t n = entities.size(), wrap = 0;
+    std::vector<bool> framed(n, true);
+    if(stackSize && !local.node.is("MainFunc")) {
+        auto nxt = optCalcNxt(entities, labels);
+        for(size_t i = 0; i < n; ++i)
+        if(!entities[i].empty() && entities[i].back().o == ojmp)
+            nxt[i] = {nxt[i].back()};
+        auto idom = optCalcIdom(nxt);
+        auto dominates = [&] (size_t d, size_t i) {
+            while(i != d && i != 0)
+                i = idom[i];
+            return i == d;
+        };
+        auto needsFrame = [&] (size_t i) {
+            auto tail = tailCalls.find(i);
+            for(size_t k = 0; k < entities[i].size(); ++k) {
+                const auto &code = entities[i][k];
+                if(tail != tailCalls.end() && k >= tail->second.first) {
+                    if(k == tail->second.second)
+                        break;
+                    if(code.o == omov && code.dst[0] != '$' && inFrame(code.dst))
+                        continue;
+                }
+                if(code.o == ocall)
+                    return true;
+                for(const auto &id : {code.dst, code.a, code.b, code.lab})
+                if(inFrame(id))
+                    return true;
+            }
+            return false;
+        };
+        bool any = false;
+        for(size_t i = 0; i < n; ++i)
+        if(idom[i] != n && needsFrame(i)) {
+            if(!any)
+                wrap = i;
+            while(!dominates(wrap, i))
+                wrap = idom[wrap];
+            any = true;
+        }
+        for(; wrap != 0; wrap = idom[wrap]) {
+            bool ok = true;
+            for(size_t i = 0; i < n; ++i)
+            if(idom[i] != n && dominates(wrap, i))
+            for(size_t j : nxt[i])
+                ok = ok && j != wrap && dominates(wrap, j);
+            if(ok)
+                break;
+        }
+        for(size_t i = 0; i < n; ++i)
+            framed[i] = idom[i] == n || dominates(wrap, i);
+        #ifdef DEBUG
+        if(wrap)
+            std::cerr << "Set up the frame of " << local.identifier << " in block " << wrap << std::endl;
+        #endif
+        if(wrap)
+            ++dumper.stats[&local]["wrap.frames"];
+    }
+    // whether the block being emitted runs with the frame in place
+    bool active = true;
+
+    auto &mipsCode = dumper.mips[local.identifier];
+
+    // operands of the last div, as long as HI and LO still hold its results
+    std::string hiloA, hiloB;
+    // index register and form of the element address left in $t9
+    std::string t9Index, t9Form;
+
+    // source line of the code being emitted, kept across code that has none
+    size_t line = local.node.startIter->getPos().getLineNumber() + 1;
 
     auto C = _code_();
     auto W = [&] (const _code_ &c) {
-        asmCode.push_back(c.s);
+        mipsCode.push_back(MIPS::parse(c.s));
+        mipsCode.back().line = line;
+        const auto &m = mipsCode.back();
+        if(m.isLabel() || m.isCall())
+            hiloA = hiloB = t9Index = t9Form = "";
+        for(const auto &r : m.defs()) {
+            if(r == hiloA || r == hiloB || r == "$hi")
+                hiloA = hiloB = "";
+            if(r == t9Index || r == "$t9")
+                t9Index = t9Form = "";
+        }
+    };
+    auto divide = [&] (const std::string &a, const std::string &b) {
+        if(hiloA == a && hiloB == b)
+            return;
+        W(C << "div " << a << ", " << b);
+        hiloA = a;
+        hiloB = b;
+    };
+
+    auto isImm = [] (const std::string &s) {
+        return !s.empty() && (isdigit(s[0]) || s[0] == '-');
+    };
+    auto fitsImm16 = [] (int64_t v) {
+        return v >= -32768 && v <= 32767;
+    };
+
+    auto elementWidth = [&] (const std::string &lab) {
+        if(rela.find(lab) != rela.end())
+            return rela[lab].second;
+        auto res = local.lookup(lab);
+        assert(res.type == TGlobalVariable);
+        assert(res.result.v->type == VarIntArray || res.result.v->type == VarCharArray);
+        return res.result.v->type == VarIntArray ? 'w' : 'b';
+    };
+    // memory operand of lab[index]: constant indexes fold into the offset,
+    // a scaled index already in $t9 is reused
+    auto element = [&] (const std::string &lab, const std::string &index) -> std::string {
+        size_t size = elementWidth(lab) == 'w' ? 4 : 1;
+        bool isLocal = rela.find(lab) != rela.end();
+        if(isImm(index)) {
+            int64_t off = std::stoll(index) * (int64_t)size;
+            if(isLocal)
+                return std::to_string(rela[lab].first + off) + "($sp)";
+            auto l = local.lookup(lab).result.v->getLabel();
+            return off ? l + (off > 0 ? "+" : "") + std::to_string(off) : l;
+        }
+        std::string base = isLocal ? std::to_string(rela[lab].first) : local.lookup(lab).result.v->getLabel();
+        if(!isLocal && size == 1)
+            return base + "(" + index + ")";
+        std::string form = std::string(size == 4 ? "w" : "b") + (isLocal ? "s" : "");
+        if(t9Index != index || t9Form != form) {
+            if(size == 4)
+                W(C << "sll $t9, " << index << ", 2");
+            if(isLocal)
+                W(C << "addu $t9, " << (size == 4 ? "$t9" : index) << ", $sp");
+            t9Index = index;
+            t9Form = form;
+        }
+        return base + "($t9)";
     };
 
+    const std::set<OP> condOps {
+        obeq, obne, oblt, oble, obgt, obge, obeqz, obnez
+    };
     std::map<OP, std::string> repr {
         {oli, "li"}, {oneg, "neg"},
         {oadd, "addu"}, {osub, "subu"}, {omul, "mul"}, {odiv, "div"},
@@ -68,9 +286,9 @@ void optToMIPS(Function &local, OptimizedDumper &dumper) {
             W(C << "j " << local.endLabel());
             return;
         }
-        if(hasCall)
+        if(saveRa && active)
             W(C << "lw $ra, " << rela["$ra"].first << "($sp)");
-        if(hasCall || hasStInter)
+        if(stackSize && active)
             W(C << "addiu $sp, $sp, " << stackSize);
         if(!dst.empty()) {
             if(dst[0] == '$') {
@@ -93,31 +311,69 @@ void optToMIPS(Function &local, OptimizedDumper &dumper) {
         W(C << "jr $ra");
     };
 
-    std::map<std::string, size_t> tp {
-        {"2", 1}, {"4", 2}, {"8", 3}, {"16", 4}, {"32", 5},
-        {"64", 6}, {"128", 7}, {"256", 8}, {"512", 9}, {"1024", 10},
-        {"2048", 11}, {"4096", 12}, {"8192", 13}, {"16384", 14},
-        {"32768", 15}, {"65536", 16}, {"131072", 17}, {"262144", 18},
-        {"524288", 19}, {"1048576", 20}, {"2097152", 21},
-        {"4194304", 22}, {"8388608", 23}, {"16777216", 24},
-        {"33554432", 25}, {"67108864", 26}, {"134217728", 27},
-        {"268435456", 28}, {"536870912", 29}, {"1073741824", 30},
-        {"2147483648", 31}
+    // -fprofile-generate: word 2i counts runs of block i, word 2i+1 the
+    // times its closing branch fell through
+    auto bump = [&] (size_t word) {
+        std::string at = "__prof_cnt_" + local.identifier + (word ? "+" + std::to_string(4 * word) : "");
+        W(C << "lw $v1, " << at);
+        W(C << "addiu $v1, $v1, 1");
+        W(C << "sw $v1, " << at);
     };
 
+    {
+        std::map<int64_t, std::string> layout;
+        for(const auto &item : rela)
+        if(!local.paramList.hasVariable(item.first))
+            layout[item.second.first] = item.first;
+        W(C << "# frame of " << local.identifier << ": "
+            << (stackSize ? std::to_string(stackSize) + " bytes" : std::string("none"))
+            << (wrap ? ", set up in " + (labels[wrap].empty() ? "block " + std::to_string(wrap) : labels[wrap])
+                : std::string()));
+        for(const auto &item : layout)
+            W(C << "#   " << std::to_string(item.first) << "($sp) " << item.second);
+        for(size_t i = 0; i < local.paramList.size(); ++i) {
+            const auto &p = local.paramList[i].identifier;
+            std::string from = i < mipsArgRegs.size() ? "passed in " + mipsArgRegs[i] : "passed on the stack";
+            if(rela.find(p) == rela.end())
+                W(C << "#   parameter " << p << " (" << from << ")");
+            else
+                W(C << "#   " << std::to_string(rela[p].first) << "($sp) parameter " << p << " (" << from << ")");
+        }
+    }
+
     for(size_t i = 0; i < entities.size(); ++i) {
         const auto &block = entities[i];
         if(!labels[i].empty())
             W(C << labels[i] << ":");
 
-        if(i == 0) {
-            if(hasCall || hasStInter)
+        active = framed[i];
+        if(i == wrap) {
+            if(stackSize)
                 W(C << "addiu $sp, $sp, -" << stackSize);
-            if(hasCall && !local.node.is("MainFunc"))
+            if(saveRa)
                 W(C << "sw $ra, " << rela["$ra"].first << "($sp)");
         }
+        if(dumper.profileGenerate)
+            bump(2 * i);
 
-        for(const auto &code: block) {
+        auto tail = tailCalls.find(i);
+        for(size_t k = 0; k < block.size(); ++k) {
+            const auto &code = block[k];
+            if(code.line)
+                line = code.line;
+            if(tail != tailCalls.end()) {
+                if(k >= tail->second.first && code.o == omov && code.dst[0] != '$' && inFrame(code.dst))
+                    continue;
+                if(k == tail->second.second) {
+                    if(saveRa && active)
+                        W(C << "lw $ra, " << rela["$ra"].first << "($sp)");
+                    if(stackSize && active)
+                        W(C << "addiu $sp, $sp, " << stackSize);
+                    W(C << "j " << local.lookup(code.lab).result.f->entryLabel());
+                    ++dumper.stats[&local]["tail.calls"];
+                    break;
+                }
+            }
             switch(code.o) {
             case oneg:
             case oli:
@@ -156,69 +412,79 @@ void optToMIPS(Function &local, OptimizedDumper &dumper) {
                 {
                     size_t i;
                     sscanf(code.dst.c_str(), "%zu", &i);
-                    W(C << calcArgInst(code.lab, i) << " " << code.a << ", " << calcArgRela(i) << "($sp)");
+                    int64_t off = calcArgRela(i) + (tail != tailCalls.end() && active ? stackSize : 0);
+                    W(C << calcArgInst(code.lab, i) << " " << code.a << ", " << off << "($sp)");
                 }
                 break;
             case oadd:
             case osub:
             case omul:
             case odiv:
-                if(code.o == oadd && (isdigit(code.b[0]) || code.b[0] == '-')) {
-                    W(C << "addiu " << code.dst << ", " << code.a << ", " << code.b);
+                if((code.o == oadd || code.o == osub) && isImm(code.b)) {
+                    int64_t v = std::stoll(code.b);
+                    if(code.o == osub)
+                        v = -v;
+                    if(fitsImm16(v)) {
+                        W(C << "addiu " << code.dst << ", " << code.a << ", " << v);
+                    } else {
+                        W(C << "li $t9, " << code.b);
+                        W(C << repr[code.o] << " " << code.dst << ", " << code.a << ", $t9");
+                    }
                     break;
                 }
-                if(code.o == omul && tp.find(code.b) != tp.end()) {
-                    W(C << "sll " << code.dst << ", " << code.a << ", " << tp[code.b]);
+                if(code.o == omul && isImm(code.b)) {
+                    int32_t c = (int32_t)std::stoll(code.b);
+                    for(const auto &line : mipsMulByConst(code.dst, code.a, c))
+                        W(C << line);
                     break;
                 }
-                if(code.o == odiv && tp.find(code.b) != tp.end()) {
-                    W(C << "sra " << code.dst << ", " << code.a << ", " << tp[code.b]);
+                if(code.o == odiv && isImm(code.b) && code.b != "0") {
+                    int32_t d;
+                    sscanf(code.b.c_str(), "%d", &d);
+                    for(const auto &line : mipsDivByConst(code.dst, code.a, d))
+                        W(C << line);
                     break;
                 }
-                W(C << repr[code.o] << " " << code.dst << ", " << code.a << ", " << code.b);
-                break;
-            case oloadarr:
-                if(rela.find(code.lab) == rela.end()) {
-                    auto res = local.lookup(code.lab);
-                    assert(res.type == TGlobalVariable);
-                    assert(res.result.v->type == VarIntArray || res.result.v->type == VarCharArray);
-                    if(res.result.v->type == VarIntArray) {
-                        W(C << "sll $t9, " << code.a << ", 2");
-                        W(C << "lw " << code.b << ", " << res.result.v->getLabel() << "($t9)");
+                if(code.o == odiv) {
+                    if(code.b[0] != '$') {
+                        W(C << "li $t9, " << code.b);
+                        divide(code.a, "$t9");
                     } else {
-                        W(C << "lb " << code.b << ", " << res.result.v->getLabel() << "(" << code.a << ")");
+                        divide(code.a, code.b);
                     }
+                    W(C << "mflo " << code.dst);
+                    break;
+                }
+                W(C << repr[code.o] << " " << code.dst << ", " << code.a << ", " << code.b);
+                break;
+            case omod:
+                if(isImm(code.b) && code.b != "0") {
+                    int32_t d;
+                    sscanf(code.b.c_str(), "%d", &d);
+                    for(const auto &line : mipsRemByConst(code.dst, code.a, d))
+                        W(C << line);
+                    break;
+                }
+                if(code.b[0] != '$') {
+                    W(C << "li $t9, " << code.b);
+                    divide(code.a, "$t9");
                 } else {
-                    if(rela[code.lab].second == 'w') {
-                        W(C << "sll $t9, " << code.a << ", 2");
-                        W(C << "addu $t9, $t9, $sp");
-                        W(C << "lw " << code.b << ", " << rela[code.lab].first << "($t9)");
-                    } else {
-                        W(C << "addu $t9, " << code.a << ", $sp");
-                        W(C << "lb " << code.b << ", " << rela[code.lab].first << "($t9)");
-                    }
+                    divide(code.a, code.b);
+                }
+                W(C << "mfhi " << code.dst);
+                break;
+            case oloadarr:
+                {
+                    auto ins = elementWidth(code.lab) == 'w' ? "lw" : "lb";
+                    auto addr = element(code.lab, code.a);
+                    W(C << ins << " " << code.b << ", " << addr);
                 }
                 break;
             case ostorearr:
-                if(rela.find(code.lab) == rela.end()) {
-                    auto res = local.lookup(code.lab);
-                    assert(res.type == TGlobalVariable);
-                    assert(res.result.v->type == VarIntArray || res.result.v->type == VarCharArray);
-                    if(res.result.v->type == VarIntArray) {
-                        W(C << "sll $t9, " << code.a << ", 2");
-                        W(C << "sw " << code.b << ", " << res.result.v->getLabel() << "($t9)");
-                    } else {
-                        W(C << "sb " << code.b << ", " << res.result.v->getLabel() << "(" << code.a << ")");
-                    }
-                } else {
-                    if(rela[code.lab].second == 'w') {
-                        W(C << "sll $t9, " << code.a << ", 2");
-                        W(C << "addu $t9, $t9, $sp");
-                        W(C << "sw " << code.b << ", " << rela[code.lab].first << "($t9)");
-                    } else {
-                        W(C << "addu $t9, " << code.a << ", $sp");
-                        W(C << "sb " << code.b << ", " << rela[code.lab].first << "($t9)");
-                    }
+                {
+                    auto ins = elementWidth(code.lab) == 'w' ? "sw" : "sb";
+                    auto addr = element(code.lab, code.a);
+                    W(C << ins << " " << code.b << ", " << addr);
                 }
                 break;
             case ojmp:
@@ -230,10 +496,31 @@ void optToMIPS(Function &local, OptimizedDumper &dumper) {
             case oble:
             case obgt:
             case obge:
-                if(code.b == "0" || code.b == "-0")
+                if(code.b == "0" || code.b == "-0") {
                     W(C << repr[code.o] << "z " << code.a << ", " << code.lab);
-                else
-                    W(C << repr[code.o] << " " << code.a << ", " << code.b << ", " << code.lab);
+                    break;
+                }
+                if(isImm(code.b) && code.o != obeq && code.o != obne) {
+                    int64_t v = std::stoll(code.b);
+                    // a < 1 is a <= 0 and a <= -1 is a < 0, the same for their negations
+                    if((code.o == oblt || code.o == obge) && v == 1) {
+                        W(C << (code.o == oblt ? "blez " : "bgtz ") << code.a << ", " << code.lab);
+                        break;
+                    }
+                    if((code.o == oble || code.o == obgt) && v == -1) {
+                        W(C << (code.o == oble ? "bltz " : "bgez ") << code.a << ", " << code.lab);
+                        break;
+                    }
+                    // a <= v is a < v + 1
+                    if(code.o == oble || code.o == obgt)
+                        ++v;
+                    if(fitsImm16(v)) {
+                        W(C << "slti $t9, " << code.a << ", " << v);
+                        W(C << (code.o == oblt || code.o == oble ? "bnez" : "beqz") << " $t9, " << code.lab);
+                        break;
+                    }
+                }
+                W(C << repr[code.o] << " " << code.a << ", " << code.b << ", " << code.lab);
                 break;
             case obeqz:
             case obnez:
@@ -275,9 +562,74 @@ void optToMIPS(Function &local, OptimizedDumper &dumper) {
                 break;
             }
         }
+        if(dumper.profileGenerate && !block.empty() && condOps.find(block.back().o) != condOps.end())
+            bump(2 * i + 1);
         W(C);
     }
 
     if(!local.node.is("MainFunc"))
         ret("");
+
+    // every run ends behind main's last block, which is where the counters
+    // of all functions are printed, one "runs taken" line per block
+    if(local.node.is("MainFunc") && dumper.profileGenerate) {
+        W(C << "li $a0, 10");
+        syscall(11);
+        W(C << "la $a0, __prof_head");
+        syscall(4);
+        W(C << "li $a0, 10");
+        syscall(11);
+        for(const auto &item : dumper.info) {
+            const auto &id = item.first->identifier;
+            W(C << "la $a0, __prof_name_" << id);
+            syscall(4);
+            W(C << "li $a0, 10");
+            syscall(11);
+            W(C << "la $t9, __prof_cnt_" << id);
+            W(C << "li $v1, " << item.second.codes.size());
+            W(C << "__prof_dump_" << id << ":");
+            W(C << "lw $a0, 0($t9)");
+            syscall(1);
+            W(C << "li $a0, 32");
+            syscall(11);
+            W(C << "lw $a0, 0($t9)");
+            W(C << "lw $v0, 4($t9)");
+            W(C << "subu $a0, $a0, $v0");
+            syscall(1);
+            W(C << "li $a0, 10");
+            syscall(11);
+            W(C << "addiu $t9, $t9, 8");
+            W(C << "addiu $v1, $v1, -1");
+            W(C << "bgtz $v1, __prof_dump_" << id);
+        }
+    }
+
+    mipsPeephole(mipsCode, dumper.stats[&local]);
+    mipsSchedule(mipsCode, dumper.latency, dumper.stats[&local]);
+    if(dumper.delaySlots)
+        mipsFillDelaySlots(mipsCode, dumper.stats[&local]);
+
+    // what a call to this function may change, for callers compiled later
+    std::set<std::string> clobbers;
+    for(const auto &m : mipsCode)
+    for(const auto &r : m.defs())
+        clobbers.insert(r);
+    for(const auto &block : entities)
+    for(const auto &code : block)
+    if(code.o == ocall && local.lookup(code.lab).result.f != &local) {
+        const auto &s = dumper.clobbers[local.lookup(code.lab).result.f];
+        clobbers.insert(s.begin(), s.end());
+    }
+    clobbers.erase("$sp");
+    dumper.clobbers[&local] = clobbers;
+
+    auto &asmCode = dumper.text[local.identifier];
+    size_t last = 0;
+    for(const auto &m : mipsCode) {
+        if(dumper.lineInfo && m.isInst() && m.line && m.line != last) {
+            asmCode.push_back("# line " + std::to_string(m.line));
+            last = m.line;
+        }
+        asmCode.push_back(m.str());
+    }
 }
@@ -53,6 +53,11 @@ void dumpOptQuad(const OptimizedDumper &dumper, std::ostream &stream) {
     stream << std::endl;
     for(const auto &item : dumper.optQuad) {
         toQuad(*item.first, item.second.codes, item.second.labels, stream);
+        auto iter = dumper.stats.find(item.first);
+        if(iter != dumper.stats.end()) {
+            for(const auto &stat : iter->second)
+                stream << "// " << stat.first << ": " << stat.second << std::endl;
+        }
         stream << std::endl;
     }
 }
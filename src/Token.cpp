@@ -3,6 +3,7 @@
 
 #include <unordered_map>
 #include <cstring>
+#include <limits>
 
 static void parseUnsigned(const SourceCode::const_iterator &iter, size_t stride, void *&_res);
 static void parseChar(const SourceCode::const_iterator &iter, size_t stride, void *&_res);
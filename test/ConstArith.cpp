@@ -0,0 +1,196 @@
+#include "MIPS.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <limits>
+#include <cstdint>
+#include <cstdlib>
+
+// Runs the sequences optToMIPS emits for multiplication, division and
+// remainder by a constant on a sweep of constants and operands and compares
+// them with what mul and div give. Exits with 1 at the first difference.
+
+// one instruction of a sequence with its registers numbered as in regNames
+struct Step {
+    std::string op;
+    std::vector<int> regs;
+    int32_t imm;
+};
+
+static const std::vector<std::string> regNames {"$zero", "$v0", "$v1", "$t9"};
+
+static bool decode(const std::vector<std::string> &seq, std::vector<Step> &steps) {
+    steps.clear();
+    for(const auto &line : seq) {
+        MIPS m = MIPS::parse(line);
+        Step step {m.op, {}, 0};
+        for(const auto &arg : m.args) {
+            if(arg[0] != '$') {
+                step.imm = (int32_t)std::stoll(arg, nullptr, 0);
+                continue;
+            }
+            size_t i = 0;
+            while(i < regNames.size() && regNames[i] != arg)
+                ++i;
+            if(i == regNames.size()) {
+                std::cerr << "Unexpected register in \"" << line << "\"" << std::endl;
+                return false;
+            }
+            step.regs.push_back((int)i);
+        }
+        steps.push_back(step);
+    }
+    return true;
+}
+
+// runs a sequence with $v1 = x, returns ($v1, $v0)
+static std::pair<int32_t, int32_t> run(const std::vector<Step> &steps, int32_t x) {
+    int32_t reg[4] = {0, 0, x, 0};
+    int32_t hi = 0;
+    for(const auto &step : steps) {
+        const auto &r = step.regs;
+        auto U = [&] (size_t i) {
+            return (uint32_t)reg[r[i]];
+        };
+        int32_t v = 0;
+        if(step.op == "li")
+            v = step.imm;
+        else if(step.op == "move")
+            v = reg[r[1]];
+        else if(step.op == "mfhi")
+            v = hi;
+        else if(step.op == "addu")
+            v = (int32_t)(U(1) + U(2));
+        else if(step.op == "subu")
+            v = (int32_t)(U(1) - U(2));
+        else if(step.op == "sra")
+            v = reg[r[1]] >> step.imm;
+        else if(step.op == "srl")
+            v = (int32_t)(U(1) >> step.imm);
+        else if(step.op == "sll")
+            v = (int32_t)(U(1) << step.imm);
+        else if(step.op == "mul")
+            v = (int32_t)(U(1) * U(2));
+        else if(step.op == "andi")
+            v = (int32_t)(U(1) & (uint32_t)step.imm);
+        else if(step.op == "mult") {
+            hi = (int32_t)(((int64_t)reg[r[0]] * (int64_t)reg[r[1]]) >> 32);
+            continue;
+        } else if(step.op == "div" && r.size() == 2) {
+            hi = reg[r[0]] % reg[r[1]];
+            continue;
+        } else {
+            std::cerr << "Unexpected instruction " << step.op << std::endl;
+            std::exit(1);
+        }
+        if(r[0] != 0)
+            reg[r[0]] = v;
+    }
+    return std::make_pair(reg[2], reg[1]);
+}
+
+// operands every constant is tried with: the ends of the range, powers of
+// two and their neighbours, multiples of c and its neighbours from both ends,
+// and pseudo-random words
+static std::vector<int32_t> operands(int32_t c) {
+    const int64_t lo = std::numeric_limits<int32_t>::min(), hi = std::numeric_limits<int32_t>::max();
+    std::vector<int64_t> xs {0, lo, lo + 1, hi, hi - 1};
+    for(int k = 0; k < 31; ++k) {
+        for(int64_t p : {1ll << k, -(1ll << k)}) {
+            xs.push_back(p - 1);
+            xs.push_back(p);
+            xs.push_back(p + 1);
+        }
+    }
+    int64_t ac = c < 0 ? -(int64_t)c : c, top = ac ? hi / ac : 0;
+    for(int64_t q : std::vector<int64_t> {1, 2, 3, 7, 1000, top - 1, top, top + 1}) {
+        for(int64_t e = -1; e <= 1; ++e) {
+            xs.push_back(q * ac + e);
+            xs.push_back(-q * ac + e);
+        }
+    }
+    uint32_t lcg = (uint32_t)c * 2654435761u;
+    for(size_t i = 0; i < 64; ++i) {
+        lcg = lcg * 1664525u + 1013904223u;
+        xs.push_back((int32_t)lcg);
+        xs.push_back((int32_t)(lcg >> (i % 31)));
+    }
+    std::vector<int32_t> r;
+    for(auto x : xs)
+        if(x >= lo && x <= hi)
+            r.push_back((int32_t)x);
+    return r;
+}
+
+// every constant of magnitude up to 3500, then the ends of the range and
+// the powers of two and their neighbours
+static std::vector<int32_t> constants() {
+    std::vector<int32_t> r;
+    for(int32_t c = -3500; c <= 3500; ++c)
+        r.push_back(c);
+    r.push_back(std::numeric_limits<int32_t>::min());
+    r.push_back(std::numeric_limits<int32_t>::min() + 1);
+    r.push_back(std::numeric_limits<int32_t>::max());
+    for(int k = 12; k < 31; ++k) {
+        for(int32_t p : {1 << k, -(1 << k)}) {
+            r.push_back(p - 1);
+            r.push_back(p);
+            r.push_back(p + 1);
+        }
+    }
+    return r;
+}
+
+static bool checkDiv(int32_t d) {
+    std::vector<Step> div, rem, remSelf;
+    if(!decode(mipsDivByConst("$v1", "$v1", d), div) ||
+            !decode(mipsRemByConst("$v0", "$v1", d), rem) ||
+            !decode(mipsRemByConst("$v1", "$v1", d), remSelf))
+        return false;
+    for(auto x : operands(d)) {
+        // overflows on the machine as well
+        if(x == std::numeric_limits<int32_t>::min() && d == -1)
+            continue;
+        if(run(div, x).first != x / d) {
+            std::cerr << "Division by " << d << " is wrong for " << x << std::endl;
+            return false;
+        }
+        if(run(rem, x).second != x % d || run(remSelf, x).first != x % d) {
+            std::cerr << "Remainder by " << d << " is wrong for " << x << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool checkMul(int32_t c) {
+    std::vector<Step> mul, self;
+    if(!decode(mipsMulByConst("$v0", "$v1", c), mul) ||
+            !decode(mipsMulByConst("$v1", "$v1", c), self))
+        return false;
+    for(auto x : operands(c)) {
+        int32_t y = (int32_t)((uint32_t)x * (uint32_t)c);
+        if(run(mul, x).second != y || run(self, x).first != y) {
+            std::cerr << "Multiplication by " << c << " is wrong for " << x << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    size_t factors = 0, divisors = 0;
+    for(auto c : constants()) {
+        if(!checkMul(c))
+            return 1;
+        ++factors;
+        if(c == 0)
+            continue;
+        if(!checkDiv(c))
+            return 1;
+        ++divisors;
+    }
+    std::cout << "ConstArith: " << factors << " factors and " << divisors << " divisors OK" << std::endl;
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "MIPSSimulator.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Runs small programs the way --run does and compares what they print.
+// Exits with 1 at the first difference.
+
+struct Case {
+    std::string name, code, input, output;
+};
+
+static const std::vector<Case> cases {
+    // a return from the middle of main jumps to the label closing .text
+    {"delayed jump to the end", R"(
+.text
+.set noreorder
+main:
+li $v0, 1
+li $a0, 7
+syscall
+j __end_func_main
+li $a0, 8
+li $v0, 1
+syscall
+__end_func_main:
+)", "", "7"},
+    {"delayed branch to the end", R"(
+.text
+.set noreorder
+main:
+li $v0, 5
+syscall
+bgtz $v0, __end_func_main
+move $a0, $v0
+li $v0, 1
+syscall
+__end_func_main:
+)", "3", ""},
+    {"delayed branch not taken", R"(
+.text
+.set noreorder
+main:
+li $v0, 5
+syscall
+bgtz $v0, __end_func_main
+move $a0, $v0
+li $v0, 1
+syscall
+__end_func_main:
+)", "-3", "-3"},
+    {"jump to the end", R"(
+.text
+main:
+li $v0, 1
+li $a0, 7
+syscall
+j __end_func_main
+li $a0, 8
+syscall
+__end_func_main:
+)", "", "7"},
+    // a char read after an int is the next character, white space or not
+    {"read char", R"(
+.text
+main:
+li $v0, 5
+syscall
+li $v0, 12
+syscall
+move $a0, $v0
+li $v0, 1
+syscall
+)", "17 Q", "32"}
+};
+
+int main() {
+    for(const auto &c : cases) {
+        MIPSSimulator sim;
+        std::istringstream code(c.code), in(c.input);
+        std::ostringstream out;
+        if(!sim.load(code) || !sim.run(in, out, 1000)) {
+            std::cerr << c.name << ": " << sim.getError() << std::endl;
+            return 1;
+        }
+        if(out.str() != c.output) {
+            std::cerr << c.name << ": printed \"" << out.str() << "\" instead of \"" << c.output << "\"" << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "Simulator: " << cases.size() << " programs OK" << std::endl;
+    return 0;
+}